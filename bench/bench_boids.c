@@ -0,0 +1,405 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sdl2/SDL_cpuinfo.h"
+#include "sdl2/SDL_timer.h"
+#include "hf_lib/hf_random.h"
+
+#include "boids.h"
+#include "boids_core.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#define popen _popen
+#define pclose _pclose
+#else
+#include <sys/resource.h>
+#endif
+
+#define FIXED_DELTA (0.005f)
+#define AREA_PER_BOID (28.4f)//same density as the windowed build
+#define BENCH_BOID_STEPS 20000000.//work per run, steps are this over the boid count
+#define BENCH_MIN_STEPS 4
+#define BENCH_MAX_STEPS 400
+#define BENCH_MAX_ITEMS 32
+#define BENCH_SEED 1
+
+typedef struct bench_config_s {
+    const char* name;
+    bool simd;
+    float skin;//neighbor lists when above 0
+    size_t nearest_k;//nearest mode when above 0
+    bool compact;
+    size_t reorder_period;
+    int species;//species boids after the first 3 predators draw from, 4 when 0
+    bool sparse;//boids only keep apart from their own species and predators
+    bool partition;
+    bool rebuild;//grid sorted from scratch every update instead of migrating boids
+    float aggregate_radius;//aggregate mode when above 0
+    float aggregate_cell;
+    size_t stagger_period;//staggered updates when above 1
+    size_t rule_period;//of every rule but separation
+    float obstacle_density;//square obstacles per boid
+    size_t substeps;//steps per boids_core_update call, more than 1 shares the neighbor search
+} bench_config;
+
+static const bench_config configs[] = {
+    { .name = "grid", .simd = true, .substeps = 1 },
+    { .name = "scalar", .simd = false, .substeps = 1 },
+    { .name = "rebuild", .simd = true, .rebuild = true, .substeps = 1 },
+    { .name = "lists", .simd = true, .skin = 1.f, .substeps = 1 },
+    { .name = "nearest", .simd = true, .nearest_k = 7, .substeps = 1 },
+    { .name = "compact", .simd = true, .compact = true, .substeps = 1 },
+    { .name = "reorder", .simd = true, .reorder_period = 16, .substeps = 1 },
+    { .name = "steps", .simd = true, .substeps = 4 },
+    { .name = "species", .simd = true, .species = 16, .sparse = true, .substeps = 1 },
+    { .name = "partition", .simd = true, .species = 16, .sparse = true, .partition = true, .substeps = 1 },
+    { .name = "aggregates", .simd = true, .aggregate_radius = 14.f, .aggregate_cell = 3.5f, .substeps = 1 },
+    { .name = "stagger", .simd = true, .stagger_period = 4, .substeps = 1 },
+    { .name = "periods", .simd = true, .rule_period = 4, .substeps = 1 },
+    { .name = "obstacles", .simd = true, .obstacle_density = .05f, .substeps = 1 },
+};
+#define CONFIGS_COUNT (sizeof(configs) / sizeof(configs[0]))
+
+typedef struct bench_result_s {
+    size_t count;
+    size_t threads;
+    const bench_config* config;
+    size_t steps;
+    double seconds;
+    size_t distance_tests;
+    size_t peak_memory;//bytes, high water mark of the process that ran it
+} bench_result;
+
+static size_t peak_memory(void) {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize : 0;
+#else
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage)) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return (size_t)usage.ru_maxrss;
+#else
+    return (size_t)usage.ru_maxrss * 1024;//kilobytes on linux
+#endif
+#endif
+}
+
+static const bench_config* config_find(const char* name) {
+    for(size_t i = 0; i < CONFIGS_COUNT; i++) {
+        if(!strcmp(configs[i].name, name)) {
+            return &configs[i];
+        }
+    }
+    return NULL;
+}
+
+//steps of one run rounded up to a multiple of the config substeps, 0 steps picks them from the count
+static size_t bench_steps(size_t count, size_t steps, const bench_config* config) {
+    if(!steps) {
+        steps = (size_t)(BENCH_BOID_STEPS / (double)(count ? count : 1));
+        steps = steps < BENCH_MIN_STEPS ? BENCH_MIN_STEPS : steps > BENCH_MAX_STEPS ? BENCH_MAX_STEPS : steps;
+    }
+    return (steps + config->substeps - 1) / config->substeps * config->substeps;
+}
+
+//randomly turned squares of side 2 to 6, drawn from streams after the boids' ones
+static bool bench_obstacles(boids_core* core, size_t count, float half_size, const bench_config* config) {
+    size_t obstacles_count = (size_t)((float)count * config->obstacle_density);
+    if(!obstacles_count) {
+        return true;
+    }
+    float* points = malloc(obstacles_count * 8 * sizeof(float));
+    size_t* points_counts = malloc(obstacles_count * sizeof(size_t));
+    if(!points || !points_counts) {
+        free(points);
+        free(points_counts);
+        return false;
+    }
+    for(size_t i = 0; i < obstacles_count; i++) {
+        size_t stream = count + i;
+        float x = hf_random_range_f(BENCH_SEED, stream, 0, -half_size, half_size);
+        float y = hf_random_range_f(BENCH_SEED, stream, 1, -half_size, half_size);
+        float half_side = hf_random_range_f(BENCH_SEED, stream, 2, 1.f, 3.f);
+        float angle = hf_random_range_f(BENCH_SEED, stream, 3, 0.f, 1.5707963f);
+        float c = cosf(angle) * half_side;
+        float s = sinf(angle) * half_side;
+        points[i * 8 + 0] = x - c + s;
+        points[i * 8 + 1] = y - s - c;
+        points[i * 8 + 2] = x + c + s;
+        points[i * 8 + 3] = y + s - c;
+        points[i * 8 + 4] = x + c - s;
+        points[i * 8 + 5] = y + s + c;
+        points[i * 8 + 6] = x - c - s;
+        points[i * 8 + 7] = y - s + c;
+        points_counts[i] = 4;
+    }
+    bool result = boids_core_set_obstacles(core, points, points_counts, obstacles_count);
+    free(points);
+    free(points_counts);
+    return result;
+}
+
+static bool bench_run(size_t count, size_t threads, const bench_config* config, size_t steps, bench_result* out_result) {
+    float half_size = sqrtf((float)count * AREA_PER_BOID) / 2.f;
+    boids_set_bounds(-half_size, -half_size, half_size, half_size);
+    boids_set_simd(config->simd);
+    boids_set_neighbor_lists(config->skin > 0.f, config->skin);
+    boids_set_nearest_neighbors(config->nearest_k > 0, config->nearest_k);
+    boids_set_compact(config->compact);
+    boids_set_reorder_period(config->reorder_period);
+    boids_set_species_partition(config->partition);
+    boids_set_incremental_grid(!config->rebuild);
+    boids_set_aggregates(config->aggregate_radius > 0.f, config->aggregate_radius, config->aggregate_cell);
+    boids_set_stagger(config->stagger_period);
+    for(int r = boids_rule_alignment; r < boids_rule_count; r++) {
+        boids_set_rule_period((boids_rule)r, config->rule_period);
+    }
+    boids_reset_interactions();
+    for(int s = 0; config->sparse && s < BOIDS_MAX_SPECIES; s++) {
+        for(int o = 0; o < BOIDS_MAX_SPECIES; o++) {
+            boids_set_interaction(boids_interaction_separation, s, o, s == o || o == 4 ? 1.f : 0.f);
+        }
+    }
+    if(!boids_set_threads(threads)) {
+        return false;
+    }
+
+    boids_core* core = boids_core_create(count);
+    if(!core) {
+        return false;
+    }
+    int species = config->species ? config->species : 4;
+    for(size_t i = 0; i < count; i++) {
+        float angle = hf_random_range_f(BENCH_SEED, i, 0, 0.f, 6.2831853f);
+        float x = hf_random_range_f(BENCH_SEED, i, 1, -half_size, half_size);
+        float y = hf_random_range_f(BENCH_SEED, i, 2, -half_size, half_size);
+        boids_core_add(core, x, y, cosf(angle), sinf(angle), i >= 3 ? hf_random_range_i(BENCH_SEED, i, 3, 0, species - 1) : 4);
+    }
+    if(!bench_obstacles(core, count, half_size, config)) {
+        boids_core_destroy(core);
+        return false;
+    }
+
+    //the first step allocates the search structures, it is left out of the timing
+    boids_core_update(core, 1, FIXED_DELTA);
+    boids_reset_stats();
+
+    Uint64 counter_start = SDL_GetPerformanceCounter();
+    for(size_t i = 0; i < steps; i += config->substeps) {
+        boids_core_update(core, config->substeps, FIXED_DELTA);
+    }
+    double seconds = (double)(SDL_GetPerformanceCounter() - counter_start) / (double)SDL_GetPerformanceFrequency();
+
+    boids_stats stats;
+    boids_get_stats(&stats);
+    *out_result = (bench_result) {
+        .count = count,
+        .threads = threads,
+        .config = config,
+        .steps = steps,
+        .seconds = seconds,
+        .distance_tests = stats.distance_tests,
+        .peak_memory = peak_memory(),
+    };
+    boids_core_destroy(core);
+    boids_set_threads(1);
+    return true;
+}
+
+//runs one configuration in a new process, so its peak memory is not hidden by larger runs before it
+static bool bench_spawn(const char* program, size_t count, size_t threads, const bench_config* config, size_t steps, bench_result* out_result) {
+    char command[1024];
+    snprintf(command, sizeof(command), "\"%s\" --run %zu %zu %s %zu", program, count, threads, config->name, steps);
+    FILE* pipe = popen(command, "r");
+    if(!pipe) {
+        return false;
+    }
+    char line[256];
+    bool read = fgets(line, sizeof(line), pipe) != NULL;
+    if(pclose(pipe) || !read) {
+        return false;
+    }
+    *out_result = (bench_result) { .count = count, .threads = threads, .config = config, .steps = steps };
+    return sscanf(line, "%lf %zu %zu", &out_result->seconds, &out_result->distance_tests, &out_result->peak_memory) == 3;
+}
+
+static void result_rates(const bench_result* result, double* out_steps_per_second, double* out_ns_per_boid_step, double* out_tests_per_boid) {
+    double boid_steps = (double)result->count * (double)result->steps;
+    *out_steps_per_second = result->seconds > 0. ? (double)result->steps / result->seconds : 0.;
+    *out_ns_per_boid_step = boid_steps > 0. ? result->seconds * 1e9 / boid_steps : 0.;
+    *out_tests_per_boid = boid_steps > 0. ? (double)result->distance_tests / boid_steps : 0.;
+}
+
+static void write_csv(FILE* file, const bench_result* results, size_t results_count) {
+    fprintf(file, "count,threads,config,steps,seconds,steps_per_second,ns_per_boid_step,distance_tests_per_boid,peak_memory_bytes\n");
+    for(size_t i = 0; i < results_count; i++) {
+        double steps_per_second, ns_per_boid_step, tests_per_boid;
+        result_rates(&results[i], &steps_per_second, &ns_per_boid_step, &tests_per_boid);
+        fprintf(file, "%zu,%zu,%s,%zu,%.6f,%.3f,%.3f,%.3f,%zu\n",
+            results[i].count, results[i].threads, results[i].config->name, results[i].steps, results[i].seconds,
+            steps_per_second, ns_per_boid_step, tests_per_boid, results[i].peak_memory);
+    }
+}
+
+static void write_json(FILE* file, const bench_result* results, size_t results_count) {
+    fprintf(file, "[\n");
+    for(size_t i = 0; i < results_count; i++) {
+        double steps_per_second, ns_per_boid_step, tests_per_boid;
+        result_rates(&results[i], &steps_per_second, &ns_per_boid_step, &tests_per_boid);
+        fprintf(file, "    { \"count\": %zu, \"threads\": %zu, \"config\": \"%s\", \"steps\": %zu, \"seconds\": %.6f, "
+            "\"steps_per_second\": %.3f, \"ns_per_boid_step\": %.3f, \"distance_tests_per_boid\": %.3f, \"peak_memory_bytes\": %zu }%s\n",
+            results[i].count, results[i].threads, results[i].config->name, results[i].steps, results[i].seconds,
+            steps_per_second, ns_per_boid_step, tests_per_boid, results[i].peak_memory, i + 1 < results_count ? "," : "");
+    }
+    fprintf(file, "]\n");
+}
+
+//comma separated list of numbers, returns how many were read
+static size_t parse_sizes(const char* text, size_t* out_values) {
+    size_t count = 0;
+    while(count < BENCH_MAX_ITEMS) {
+        char* end;
+        size_t value = strtoul(text, &end, 10);
+        if(end == text) {
+            break;
+        }
+        out_values[count++] = value;
+        if(*end != ',') {
+            break;
+        }
+        text = end + 1;
+    }
+    return count;
+}
+
+static size_t parse_configs(const char* text, const bench_config** out_configs) {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "%s", text);
+    size_t count = 0;
+    for(char* name = strtok(buffer, ","); name && count < BENCH_MAX_ITEMS; name = strtok(NULL, ",")) {
+        const bench_config* config = config_find(name);
+        if(!config) {
+            fprintf(stderr, "unknown config %s\n", name);
+            return 0;
+        }
+        out_configs[count++] = config;
+    }
+    return count;
+}
+
+static void print_usage(const char* program) {
+    fprintf(stderr, "usage: %s [--counts 1000,10000,...] [--threads 1,2,...] [--configs grid,lists,...] [--steps n] [--format csv|json] [--out file]\n", program);
+    fprintf(stderr, "configs:");
+    for(size_t i = 0; i < CONFIGS_COUNT; i++) {
+        fprintf(stderr, " %s", configs[i].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char** argv) {
+    //single run in a child process: --run count threads config steps, prints seconds, tests and peak memory
+    if(argc == 6 && !strcmp(argv[1], "--run")) {
+        const bench_config* config = config_find(argv[4]);
+        bench_result result;
+        if(!config || !bench_run(strtoul(argv[2], NULL, 10), strtoul(argv[3], NULL, 10), config, strtoul(argv[5], NULL, 10), &result)) {
+            return EXIT_FAILURE;
+        }
+        printf("%.9f %zu %zu\n", result.seconds, result.distance_tests, result.peak_memory);
+        return EXIT_SUCCESS;
+    }
+
+    size_t counts[BENCH_MAX_ITEMS] = { 1000, 10000, 100000, 1000000 };
+    size_t counts_count = 4;
+    size_t threads[BENCH_MAX_ITEMS];
+    size_t threads_count = 0;
+    size_t cpus = (size_t)SDL_GetCPUCount();
+    for(size_t t = 1; t < cpus && threads_count < BENCH_MAX_ITEMS - 1; t *= 2) {
+        threads[threads_count++] = t;
+    }
+    threads[threads_count++] = cpus;
+    const bench_config* run_configs[BENCH_MAX_ITEMS];
+    size_t configs_count = 0;
+    for(; configs_count < CONFIGS_COUNT; configs_count++) {
+        run_configs[configs_count] = &configs[configs_count];
+    }
+    size_t steps = 0;
+    bool json = false;
+    const char* out_path = NULL;
+
+    for(int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if(!strcmp(argv[i], "--counts") && has_value) {
+            counts_count = parse_sizes(argv[++i], counts);
+        }
+        else if(!strcmp(argv[i], "--threads") && has_value) {
+            threads_count = parse_sizes(argv[++i], threads);
+        }
+        else if(!strcmp(argv[i], "--configs") && has_value) {
+            configs_count = parse_configs(argv[++i], run_configs);
+        }
+        else if(!strcmp(argv[i], "--steps") && has_value) {
+            steps = strtoul(argv[++i], NULL, 10);
+        }
+        else if(!strcmp(argv[i], "--format") && has_value) {
+            json = !strcmp(argv[++i], "json");
+        }
+        else if(!strcmp(argv[i], "--out") && has_value) {
+            out_path = argv[++i];
+        }
+        else {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if(!counts_count || !threads_count || !configs_count) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    size_t results_capacity = counts_count * threads_count * configs_count;
+    bench_result* results = malloc(results_capacity * sizeof(bench_result));
+    if(!results) {
+        return EXIT_FAILURE;
+    }
+    size_t results_count = 0;
+    for(size_t c = 0; c < counts_count; c++) {
+        for(size_t k = 0; k < configs_count; k++) {
+            for(size_t t = 0; t < threads_count; t++) {
+                size_t run_steps = bench_steps(counts[c], steps, run_configs[k]);
+                bench_result* result = &results[results_count];
+                if(!bench_spawn(argv[0], counts[c], threads[t], run_configs[k], run_steps, result)) {
+                    fprintf(stderr, "%zu boids, %zu threads, %s: failed\n", counts[c], threads[t], run_configs[k]->name);
+                    continue;
+                }
+                fprintf(stderr, "%zu boids, %zu threads, %s: %.1f steps/s\n", counts[c], threads[t], run_configs[k]->name, (double)run_steps / result->seconds);
+                results_count++;
+            }
+        }
+    }
+
+    FILE* file = out_path ? fopen(out_path, "w") : stdout;
+    if(!file) {
+        fprintf(stderr, "could not open %s\n", out_path);
+        free(results);
+        return EXIT_FAILURE;
+    }
+    if(json) {
+        write_json(file, results, results_count);
+    }
+    else {
+        write_csv(file, results, results_count);
+    }
+    if(file != stdout) {
+        fclose(file);
+    }
+    free(results);
+    return results_count ? EXIT_SUCCESS : EXIT_FAILURE;
+}
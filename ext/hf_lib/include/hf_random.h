@@ -0,0 +1,29 @@
+#ifndef HF_RANDOM_H
+#define HF_RANDOM_H
+
+#include <stdint.h>
+
+//counter based random numbers: every value is a pure function of (seed, stream, index), so any thread
+//can draw any value of any stream without shared state and the results never depend on the order.
+//Each stream is a SplitMix64 sequence whose state is the seed and stream hashed together.
+uint64_t hf_random_u64(uint64_t seed, uint64_t stream, uint64_t index);
+uint32_t hf_random_u32(uint64_t seed, uint64_t stream, uint64_t index);
+float hf_random_float(uint64_t seed, uint64_t stream, uint64_t index);//[0, 1)
+float hf_random_range_f(uint64_t seed, uint64_t stream, uint64_t index, float min, float max);//[min, max)
+int hf_random_range_i(uint64_t seed, uint64_t stream, uint64_t index, int min, int max);//[min, max]
+
+//sequential draws from one stream, the nth draw equals the indexed functions at index n
+typedef struct hf_random_s {
+    uint64_t seed;
+    uint64_t stream;
+    uint64_t index;
+} hf_random;
+
+void hf_random_init(hf_random* random, uint64_t seed, uint64_t stream);
+uint64_t hf_random_next_u64(hf_random* random);
+uint32_t hf_random_next_u32(hf_random* random);
+float hf_random_next_float(hf_random* random);
+float hf_random_next_range_f(hf_random* random, float min, float max);
+int hf_random_next_range_i(hf_random* random, int min, int max);
+
+#endif//HF_RANDOM_H
@@ -0,0 +1,62 @@
+#include "../include/hf_random.h"
+
+#define HF_RANDOM_GOLDEN 0x9E3779B97F4A7C15ull
+
+//SplitMix64 output function, a bijection on 64 bit values
+static uint64_t random_mix(uint64_t value) {
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+    return value ^ (value >> 31);
+}
+
+uint64_t hf_random_u64(uint64_t seed, uint64_t stream, uint64_t index) {
+    //both mixes are bijections, so different streams of one seed never share a state
+    uint64_t state = random_mix(seed ^ random_mix(stream + HF_RANDOM_GOLDEN));
+    return random_mix(state + (index + 1) * HF_RANDOM_GOLDEN);
+}
+
+uint32_t hf_random_u32(uint64_t seed, uint64_t stream, uint64_t index) {
+    return (uint32_t)(hf_random_u64(seed, stream, index) >> 32);
+}
+
+float hf_random_float(uint64_t seed, uint64_t stream, uint64_t index) {
+    //24 bits fill the float mantissa exactly, so 1 can't be reached by rounding
+    return (float)(hf_random_u64(seed, stream, index) >> 40) * (1.f / 16777216.f);
+}
+
+float hf_random_range_f(uint64_t seed, uint64_t stream, uint64_t index, float min, float max) {
+    return min + (max - min) * hf_random_float(seed, stream, index);
+}
+
+int hf_random_range_i(uint64_t seed, uint64_t stream, uint64_t index, int min, int max) {
+    uint64_t span = (uint64_t)((int64_t)max - (int64_t)min) + 1;
+    return (int)((int64_t)min + (int64_t)(((uint64_t)hf_random_u32(seed, stream, index) * span) >> 32));
+}
+
+void hf_random_init(hf_random* random, uint64_t seed, uint64_t stream) {
+    *random = (hf_random) {
+        .seed = seed,
+        .stream = stream,
+        .index = 0,
+    };
+}
+
+uint64_t hf_random_next_u64(hf_random* random) {
+    return hf_random_u64(random->seed, random->stream, random->index++);
+}
+
+uint32_t hf_random_next_u32(hf_random* random) {
+    return hf_random_u32(random->seed, random->stream, random->index++);
+}
+
+float hf_random_next_float(hf_random* random) {
+    return hf_random_float(random->seed, random->stream, random->index++);
+}
+
+float hf_random_next_range_f(hf_random* random, float min, float max) {
+    return hf_random_range_f(random->seed, random->stream, random->index++, min, max);
+}
+
+int hf_random_next_range_i(hf_random* random, int min, int max) {
+    return hf_random_range_i(random->seed, random->stream, random->index++, min, max);
+}
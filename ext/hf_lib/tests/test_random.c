@@ -0,0 +1,48 @@
+#include <stdlib.h>
+#include <assert.h>
+
+#include "../include/hf_random.h"
+
+int main(int argc, char** argv) {
+    {//indexed draws are pure functions of their arguments
+        assert(hf_random_u64(7, 3, 11) == hf_random_u64(7, 3, 11));
+        assert(hf_random_u64(7, 3, 11) != hf_random_u64(7, 3, 12));
+        assert(hf_random_u64(7, 3, 11) != hf_random_u64(7, 4, 11));
+        assert(hf_random_u64(7, 3, 11) != hf_random_u64(8, 3, 11));
+    }
+    {//sequential draws match the indexed ones in any order
+        hf_random random;
+        hf_random_init(&random, 42, 5);
+        for(uint64_t i = 0; i < 100; i++) {
+            assert(hf_random_next_u64(&random) == hf_random_u64(42, 5, i));
+        }
+        for(uint64_t i = 100; i-- > 0;) {
+            hf_random_init(&random, 42, 5);
+            random.index = i;
+            assert(hf_random_next_float(&random) == hf_random_float(42, 5, i));
+        }
+    }
+    {//ranges
+        double sum = 0.;
+        int hits[7] = { 0 };
+        for(uint64_t i = 0; i < 100000; i++) {
+            float value = hf_random_float(1, i, 0);
+            assert(value >= 0.f && value < 1.f);
+            sum += value;
+
+            float ranged = hf_random_range_f(1, i, 1, -2.f, 3.f);
+            assert(ranged >= -2.f && ranged < 3.f);
+
+            int integer = hf_random_range_i(1, i, 2, -3, 3);
+            assert(integer >= -3 && integer <= 3);
+            hits[integer + 3]++;
+        }
+        assert(sum / 100000. > .49 && sum / 100000. < .51);
+        for(int i = 0; i < 7; i++) {
+            assert(hits[i] > 100000 / 7 * 9 / 10);
+        }
+        assert(hf_random_range_i(1, 2, 3, 5, 5) == 5);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -1,10 +1,72 @@
 #include "boids.h"
 
 #include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
-#include "hf_lib/hf_transform.h"
+#include "boids_parallel.h"
+#include "hf_lib/hf_line.h"
+#include "hf_lib/hf_shape.h"
+#include "sdl2/SDL_atomic.h"
+
+//x86-64 always has SSE2, AVX2 has to be enabled by the build (see BOIDS_AVX2 in CMakeLists.txt)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define BOIDS_SIMD_WIDTH 8
+typedef __m256 simd_float;
+#define simd_set1(a) _mm256_set1_ps(a)
+#define simd_loadu(p) _mm256_loadu_ps(p)
+#define simd_storeu(p, a) _mm256_storeu_ps(p, a)
+#define simd_add(a, b) _mm256_add_ps(a, b)
+#define simd_sub(a, b) _mm256_sub_ps(a, b)
+#define simd_mul(a, b) _mm256_mul_ps(a, b)
+#define simd_div(a, b) _mm256_div_ps(a, b)
+#define simd_sqrt(a) _mm256_sqrt_ps(a)
+#define simd_and(a, b) _mm256_and_ps(a, b)
+#define simd_andnot(a, b) _mm256_andnot_ps(a, b)
+#define simd_less(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define simd_equal(a, b) _mm256_cmp_ps(a, b, _CMP_EQ_OQ)
+#define simd_mask(a) _mm256_movemask_ps(a)
+#define simd_round(a) _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+#define simd_load_u16(p) _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(const void*)(p))))
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BOIDS_SIMD_WIDTH 4
+typedef __m128 simd_float;
+#define simd_set1(a) _mm_set1_ps(a)
+#define simd_loadu(p) _mm_loadu_ps(p)
+#define simd_storeu(p, a) _mm_storeu_ps(p, a)
+#define simd_add(a, b) _mm_add_ps(a, b)
+#define simd_sub(a, b) _mm_sub_ps(a, b)
+#define simd_mul(a, b) _mm_mul_ps(a, b)
+#define simd_div(a, b) _mm_div_ps(a, b)
+#define simd_sqrt(a) _mm_sqrt_ps(a)
+#define simd_and(a, b) _mm_and_ps(a, b)
+#define simd_andnot(a, b) _mm_andnot_ps(a, b)
+#define simd_less(a, b) _mm_cmplt_ps(a, b)
+#define simd_equal(a, b) _mm_cmpeq_ps(a, b)
+#define simd_mask(a) _mm_movemask_ps(a)
+#define simd_round(a) _mm_cvtepi32_ps(_mm_cvtps_epi32(a))
+#define simd_load_u16(p) _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(const void*)(p)), _mm_setzero_si128()))
+#endif
 
 #define BOIDS_MAX_NEIGHBORS 50
+#define BOIDS_MAX_RADIUS 11.f//largest radius used by any rule, also the grid cell size
+#define BOIDS_VERLET_MAX_CANDIDATES 256//boids with longer lists keep using the grid
+#define BOIDS_WORLD_ALIGNMENT 64
+#define BOIDS_UPDATE_CHUNK 256//boids per parallel work item
+#define BOIDS_GRID_WINDOWS 16//max index windows a grid query walks, it can stop early after each one
+#define BOIDS_GRID_MIGRATION_DIVISOR 8//a grid update falls back to a full build when more than count / this boids change bucket
+#define BOIDS_KD_LEAF_SIZE 8
+#define BOIDS_STEPS_MIN_SKIN 1.f//skin range of the neighbor lists of boids_world_update_steps, the lower
+#define BOIDS_STEPS_MAX_SKIN 2.f//bound keeps short batches from rebuilding every time
+#define BOIDS_OBSTACLE_RADIUS 4.f//boids steer away from obstacles closer than this
+#define BOIDS_OBSTACLE_INTENSITY 8.f
+#define BOIDS_BVH_LEAF_SIZE 4
+#define BOIDS_BVH_BINS 16
+#define BOIDS_BVH_MAX_DEPTH 48//deeper ranges become leaves, so traversal stacks have a fixed size
 
 static struct {
     float min_x;
@@ -12,237 +74,3313 @@ static struct {
     float max_x;
     float max_y;
 } bounds;
+//bounds size for minimum image distances, everything is zero while bounds are unset
+static struct {
+    float x;
+    float y;
+    float inv_x;
+    float inv_y;
+} period;
 static float max_speed = 5.f;
+static bool simd_enabled = true;
+static bool compact_enabled = false;
+static bool species_partition = false;
+static bool grid_incremental = true;
+static boids_stats stats;
+static void* rule_cache_world;//memory of the world the rule cache was filled for, see rule_cache_prepare
+static void* verlet_world;//memory of the world the neighbor lists were built for, NULL once they went stale
 
 void boids_set_bounds(float min_x, float min_y, float max_x, float max_y) {
     bounds.min_x = min_x;
     bounds.min_y = min_y;
     bounds.max_x = max_x;
     bounds.max_y = max_y;
+
+    period.x = max_x > min_x ? max_x - min_x : 0.f;
+    period.y = max_y > min_y ? max_y - min_y : 0.f;
+    period.inv_x = period.x > 0.f ? 1.f / period.x : 0.f;
+    period.inv_y = period.y > 0.f ? 1.f / period.y : 0.f;
+    verlet_world = NULL;//pairs across the wrap changed
+}
+
+//shortest offset between two points on the torus described by bounds, matching the position wrap
+static void wrap_offset(float dx, float dy, hf_vec2f out) {
+    out[0] = dx - period.x * rintf(dx * period.inv_x);
+    out[1] = dy - period.y * rintf(dy * period.inv_y);
 }
 
 void boids_set_max_speed(float speed) {
     max_speed = speed;
 }
 
-static void boid_get_neighbors(boid* b, boid* boids, size_t boids_count, float radius, boid* out_neighbors, size_t* out_neighbors_count) {
-    *out_neighbors_count = 0;
-    for(size_t i = 0; i < boids_count; i++) {
-        if(*out_neighbors_count >= BOIDS_MAX_NEIGHBORS) {
-            break;
+void boids_set_simd(bool enabled) {
+    simd_enabled = enabled;
+}
+
+void boids_set_compact(bool enabled) {
+    compact_enabled = enabled;
+}
+
+void boids_set_species_partition(bool enabled) {
+    species_partition = enabled;
+}
+
+void boids_set_incremental_grid(bool enabled) {
+    grid_incremental = enabled;
+}
+
+//row and column of a species in the interaction matrix, species outside it share the last ones
+static size_t species_index(int species) {
+    return (unsigned int)species < BOIDS_MAX_SPECIES ? (size_t)species : BOIDS_MAX_SPECIES - 1;
+}
+
+//every array starts on its own cache line
+static size_t world_array_size(size_t capacity, size_t item_size) {
+    size_t size = capacity * item_size;
+    return (size + BOIDS_WORLD_ALIGNMENT - 1) / BOIDS_WORLD_ALIGNMENT * BOIDS_WORLD_ALIGNMENT;
+}
+
+bool boids_world_init(boids_world* world, size_t capacity) {
+    size_t floats_size = world_array_size(capacity, sizeof(float));
+    size_t species_size = world_array_size(capacity, sizeof(int));
+    size_t ids_size = world_array_size(capacity, sizeof(size_t));
+    size_t generations_size = world_array_size(capacity, sizeof(uint32_t));
+    void* memory = malloc(floats_size * 6 + species_size + ids_size * 2 + generations_size + BOIDS_WORLD_ALIGNMENT);
+    if(!memory) {
+        *world = (boids_world) { 0 };
+        return false;
+    }
+
+    char* aligned = (char*)memory + (BOIDS_WORLD_ALIGNMENT - (uintptr_t)memory % BOIDS_WORLD_ALIGNMENT);
+    *world = (boids_world) {
+        .count = 0,
+        .capacity = capacity,
+        .x = (float*)(void*)aligned,
+        .y = (float*)(void*)(aligned + floats_size),
+        .vx = (float*)(void*)(aligned + floats_size * 2),
+        .vy = (float*)(void*)(aligned + floats_size * 3),
+        .ax = (float*)(void*)(aligned + floats_size * 4),
+        .ay = (float*)(void*)(aligned + floats_size * 5),
+        .species = (int*)(void*)(aligned + floats_size * 6),
+        .ids = (size_t*)(void*)(aligned + floats_size * 6 + species_size),
+        .slots = (size_t*)(void*)(aligned + floats_size * 6 + species_size + ids_size),
+        .generations = (uint32_t*)(void*)(aligned + floats_size * 6 + species_size + ids_size * 2),
+        .free_id = SIZE_MAX,
+        .memory = memory,
+    };
+    return true;
+}
+
+void boids_world_deinit(boids_world* world) {
+    boids_world_drain_requests(world);
+    if(rule_cache_world == world->memory) {
+        rule_cache_world = NULL;
+    }
+    if(verlet_world == world->memory) {
+        verlet_world = NULL;
+    }
+    boids_world_set_obstacles(world, NULL, NULL, 0);
+    free(world->memory);
+    *world = (boids_world) { 0 };
+}
+
+//copies the boids and the pool state, the requests stay with src and each world keeps its obstacles
+bool boids_world_copy(boids_world* dest, boids_world* src) {
+    if(src->count > dest->capacity || src->ids_count > dest->capacity) {
+        return false;
+    }
+    dest->count = src->count;
+    dest->ids_count = src->ids_count;
+    dest->free_id = src->free_id;
+    dest->dead_count = src->dead_count;
+    memcpy(dest->x, src->x, src->count * sizeof(float));
+    memcpy(dest->y, src->y, src->count * sizeof(float));
+    memcpy(dest->vx, src->vx, src->count * sizeof(float));
+    memcpy(dest->vy, src->vy, src->count * sizeof(float));
+    memcpy(dest->ax, src->ax, src->count * sizeof(float));
+    memcpy(dest->ay, src->ay, src->count * sizeof(float));
+    memcpy(dest->species, src->species, src->count * sizeof(int));
+    memcpy(dest->ids, src->ids, src->count * sizeof(size_t));
+    memcpy(dest->slots, src->slots, src->ids_count * sizeof(size_t));
+    memcpy(dest->generations, src->generations, src->ids_count * sizeof(uint32_t));
+    return true;
+}
+
+bool boids_world_add(boids_world* world, hf_vec2f position, hf_vec2f velocity, int species) {
+    if(world->count >= world->capacity) {
+        return false;
+    }
+    return boids_world_spawn(world, position, velocity, species).id != SIZE_MAX;
+}
+
+bool boids_world_reserve(boids_world* world, size_t capacity) {
+    if(capacity <= world->capacity) {
+        return true;
+    }
+    boids_world grown;
+    if(!boids_world_init(&grown, capacity)) {
+        return false;
+    }
+    boids_world_copy(&grown, world);
+
+    //only the arrays move, other threads may be pushing requests meanwhile
+    if(rule_cache_world == world->memory) {
+        rule_cache_world = grown.memory;
+    }
+    if(verlet_world == world->memory) {
+        verlet_world = grown.memory;
+    }
+    free(world->memory);
+    world->capacity = grown.capacity;
+    world->x = grown.x;
+    world->y = grown.y;
+    world->vx = grown.vx;
+    world->vy = grown.vy;
+    world->ax = grown.ax;
+    world->ay = grown.ay;
+    world->species = grown.species;
+    world->ids = grown.ids;
+    world->slots = grown.slots;
+    world->generations = grown.generations;
+    world->memory = grown.memory;
+    return true;
+}
+
+boids_handle boids_world_spawn(boids_world* world, hf_vec2f position, hf_vec2f velocity, int species) {
+    if(world->count >= world->capacity && !boids_world_reserve(world, world->capacity ? world->capacity * 2 : 64)) {
+        return (boids_handle) { .id = SIZE_MAX };
+    }
+
+    //a new id is only needed when every id is live, so there are never more ids than slots
+    size_t id = world->free_id;
+    if(id != SIZE_MAX) {
+        world->free_id = world->slots[id];
+    }
+    else {
+        id = world->ids_count++;
+        world->generations[id] = 0;
+    }
+
+    size_t i = world->count++;
+    world->x[i] = position[0];
+    world->y[i] = position[1];
+    world->vx[i] = velocity[0];
+    world->vy[i] = velocity[1];
+    world->ax[i] = 0.f;
+    world->ay[i] = 0.f;
+    world->species[i] = species;
+    world->ids[i] = id;
+    world->slots[id] = i;
+    return (boids_handle) { .id = id, .generation = world->generations[id] };
+}
+
+bool boids_world_alive(boids_world* world, boids_handle handle) {
+    return handle.id < world->ids_count && world->generations[handle.id] == handle.generation;
+}
+
+boids_handle boids_world_handle(boids_world* world, size_t slot) {
+    if(slot >= world->count || world->ids[slot] == SIZE_MAX) {
+        return (boids_handle) { .id = SIZE_MAX };
+    }
+    return (boids_handle) { .id = world->ids[slot], .generation = world->generations[world->ids[slot]] };
+}
+
+//the slot stays in place until compaction, but the id is free right away
+bool boids_world_despawn(boids_world* world, boids_handle handle) {
+    if(!boids_world_alive(world, handle)) {
+        return false;
+    }
+    world->ids[world->slots[handle.id]] = SIZE_MAX;
+    world->dead_count++;
+    world->generations[handle.id]++;
+    world->slots[handle.id] = world->free_id;
+    world->free_id = handle.id;
+    return true;
+}
+
+//how far the accelerations boids kept between staggered updates had moved from the new ones
+typedef struct drift_sums_s {
+    size_t count;
+    double sum;
+    float max;
+} drift_sums;
+
+typedef struct chunk_stats_s {
+    size_t tests;
+    drift_sums drift;
+} chunk_stats;
+
+//distance tests and stagger drift of each update chunk, summed into the stats in chunk order once
+//the update is done. Every chunk only writes its own entry, so workers never share a counter.
+static struct {
+    chunk_stats* chunks;
+    size_t capacity;
+    size_t count;
+} update_stats;
+
+static void update_stats_prepare(size_t boids_count) {
+    size_t count = (boids_count + BOIDS_UPDATE_CHUNK - 1) / BOIDS_UPDATE_CHUNK;
+    if(count > update_stats.capacity) {
+        chunk_stats* new_chunks = realloc(update_stats.chunks, count * sizeof(chunk_stats));
+        if(!new_chunks) {
+            update_stats.count = 0;
+            return;
         }
+        update_stats.chunks = new_chunks;
+        update_stats.capacity = count;
+    }
+    memset(update_stats.chunks, 0, count * sizeof(chunk_stats));
+    update_stats.count = count;
+}
 
-        boid* other = &boids[i];
-        if(b == other) {
-            continue;
+//begin has to be the start of an update chunk
+static void tests_add(size_t begin, size_t count) {
+    if(begin / BOIDS_UPDATE_CHUNK < update_stats.count) {
+        update_stats.chunks[begin / BOIDS_UPDATE_CHUNK].tests += count;
+    }
+}
+
+static void drift_add(size_t begin, const drift_sums* drift) {
+    if(begin / BOIDS_UPDATE_CHUNK < update_stats.count) {
+        update_stats.chunks[begin / BOIDS_UPDATE_CHUNK].drift = *drift;
+    }
+}
+
+static void update_stats_collect(void) {
+    for(size_t i = 0; i < update_stats.count; i++) {
+        const chunk_stats* chunk = &update_stats.chunks[i];
+        stats.distance_tests += chunk->tests;
+        stats.stagger_evaluations += chunk->drift.count;
+        stats.stagger_drift += chunk->drift.sum;
+        stats.stagger_drift_max = chunk->drift.max > stats.stagger_drift_max ? chunk->drift.max : stats.stagger_drift_max;
+    }
+    update_stats.count = 0;
+}
+
+//state of one boid in compact mode, position inside its cell in 1/65536 of the cell size rounded
+//down and velocity in 1/32767 of max_speed rounded
+typedef struct grid_compact_boid_s {
+    uint16_t column;
+    uint16_t row;
+    uint16_t x;
+    uint16_t y;
+    int16_t vx;
+    int16_t vy;
+    int16_t species;
+} grid_compact_boid;
+
+//uniform grid, updated once per update. items holds boid indices bucketed by cell, and by species
+//inside each cell when partitioned, ascending inside each bucket, so queries can walk them in the
+//same order as the array. Buckets keep spare slots after their boids, so an update only has to
+//move the boids that changed bucket, while the layout stays the same.
+static struct {
+    float min_x;
+    float min_y;
+    float cell_width;//at least the requested cell size, so that whole cells tile the bounds
+    float cell_height;
+    int width;
+    int height;
+    size_t species_count;//buckets per cell, by species_index, 1 unless species partitioned
+    size_t buckets_count;
+    size_t* cell_start;//first slot of each bucket, buckets_count + 1 entries, the last one is the slots count
+    size_t* cell_end;//end of the boids of each bucket, the slots up to the next start are spare
+    size_t* items;
+    float* items_x;//positions in items order, so SIMD tests can load candidates contiguously
+    float* items_y;
+    size_t* boid_cell;//bucket of each boid
+    size_t* boid_slot;//position of each boid in items
+    size_t boids_count;
+    size_t cells_capacity;
+    size_t items_capacity;
+    bool valid;
+    //compact mode fills these instead of items_x and items_y
+    bool compact;
+    uint16_t* items_qx;//grid_compact_boid positions in items order, for the tests
+    uint16_t* items_qy;
+    grid_compact_boid* boids_compact;//in world order, for the neighbors that pass
+    size_t compact_capacity;
+} grid;
+
+//cell coordinate of value, wrapped around like positions are
+static int grid_coord(float value, float min, float cell_size, int size) {
+    float cell = floorf((value - min) / cell_size);
+    if(cell >= 0.f && cell < (float)size) {
+        return (int)cell;
+    }
+    if(!(fabsf(cell) < 16777216.f)) {//NaN, infinity or beyond float integer precision
+        return 0;
+    }
+    int coord = (int)fmodf(cell, (float)size);
+    return coord < 0 ? coord + size : coord;
+}
+
+static int grid_coord_x(float x) {
+    return grid_coord(x, grid.min_x, grid.cell_width, grid.width);
+}
+
+static int grid_coord_y(float y) {
+    return grid_coord(y, grid.min_y, grid.cell_height, grid.height);
+}
+
+//cells of the wrapped 3x3 block around a position, each one once even when the grid is narrower than 3 cells
+static size_t grid_block(float x, float y, size_t* out_cells) {
+    int cx = grid_coord_x(x);
+    int cy = grid_coord_y(y);
+    int columns[3];
+    int rows[3];
+    size_t columns_count = 0;
+    size_t rows_count = 0;
+    for(int d = -1; d <= 1; d++) {
+        int column = (cx + d + grid.width) % grid.width;
+        int row = (cy + d + grid.height) % grid.height;
+        if(!columns_count || (column != columns[0] && (columns_count < 2 || column != columns[1]))) {
+            columns[columns_count++] = column;
+        }
+        if(!rows_count || (row != rows[0] && (rows_count < 2 || row != rows[1]))) {
+            rows[rows_count++] = row;
+        }
+    }
+
+    size_t count = 0;
+    for(size_t r = 0; r < rows_count; r++) {
+        for(size_t c = 0; c < columns_count; c++) {
+            out_cells[count++] = (size_t)rows[r] * (size_t)grid.width + (size_t)columns[c];
+        }
+    }
+    return count;
+}
+
+//squared distance from a position to the nearest point of a cell, around the wrap. Cells are
+//widened by 1/1024 of their size so boids sorted into them at their edges by rounding still count.
+static float grid_cell_distance_sqr(size_t cell, hf_vec2f position) {
+    float column = (float)(cell % (size_t)grid.width);
+    float row = (float)(cell / (size_t)grid.width);
+    hf_vec2f offset;
+    wrap_offset(grid.min_x + (column + .5f) * grid.cell_width - position[0], grid.min_y + (row + .5f) * grid.cell_height - position[1], offset);
+    float dx = fmaxf(fabsf(offset[0]) - grid.cell_width * (.5f + 1.f / 1024.f), 0.f);
+    float dy = fmaxf(fabsf(offset[1]) - grid.cell_height * (.5f + 1.f / 1024.f), 0.f);
+    return dx * dx + dy * dy;
+}
+
+static bool grid_reserve(size_t cells_count, size_t items_count) {
+    if(cells_count + 1 > grid.cells_capacity) {
+        size_t* new_memory = realloc(grid.cell_start, (cells_count + 1) * sizeof(size_t));
+        if(!new_memory) {
+            return false;
+        }
+        grid.cell_start = new_memory;
+
+        new_memory = realloc(grid.cell_end, (cells_count + 1) * sizeof(size_t));
+        if(!new_memory) {
+            return false;
         }
+        grid.cell_end = new_memory;
+        grid.cells_capacity = cells_count + 1;
+    }
+    if(items_count > grid.items_capacity) {
+        size_t* new_items = realloc(grid.items, items_count * sizeof(size_t));
+        if(!new_items) {
+            return false;
+        }
+        grid.items = new_items;
+
+        size_t* new_boid_cell = realloc(grid.boid_cell, items_count * sizeof(size_t));
+        if(!new_boid_cell) {
+            return false;
+        }
+        grid.boid_cell = new_boid_cell;
+
+        size_t* new_boid_slot = realloc(grid.boid_slot, items_count * sizeof(size_t));
+        if(!new_boid_slot) {
+            return false;
+        }
+        grid.boid_slot = new_boid_slot;
+
+        float* new_items_x = realloc(grid.items_x, items_count * sizeof(float));
+        if(!new_items_x) {
+            return false;
+        }
+        grid.items_x = new_items_x;
 
-        float dist_sqr = hf_vec2f_square_distance(b->position, other->position);
-        if(dist_sqr < (radius * radius)) {
-            out_neighbors[(*out_neighbors_count)++] = *other;
+        float* new_items_y = realloc(grid.items_y, items_count * sizeof(float));
+        if(!new_items_y) {
+            return false;
         }
+        grid.items_y = new_items_y;
+        grid.items_capacity = items_count;
+    }
+    return true;
+}
+
+static bool grid_reserve_compact(size_t items_count) {
+    if(items_count <= grid.compact_capacity) {
+        return true;
+    }
+    uint16_t* new_items_qx = realloc(grid.items_qx, items_count * sizeof(uint16_t));
+    if(!new_items_qx) {
+        return false;
+    }
+    grid.items_qx = new_items_qx;
+
+    uint16_t* new_items_qy = realloc(grid.items_qy, items_count * sizeof(uint16_t));
+    if(!new_items_qy) {
+        return false;
+    }
+    grid.items_qy = new_items_qy;
+
+    grid_compact_boid* new_boids_compact = realloc(grid.boids_compact, items_count * sizeof(grid_compact_boid));
+    if(!new_boids_compact) {
+        return false;
+    }
+    grid.boids_compact = new_boids_compact;
+    grid.compact_capacity = items_count;
+    return true;
+}
+
+static uint16_t quantize_cell(float value, float min, float cell_size) {
+    float cell = (value - min) / cell_size;
+    float fraction = (cell - floorf(cell)) * 65536.f;
+    if(!(fraction >= 0.f)) {//NaN or infinity
+        return 0;
+    }
+    return fraction < 65535.f ? (uint16_t)fraction : 65535;
+}
+
+static int16_t quantize_velocity(float value) {
+    float scaled = rintf(value * (32767.f / max_speed));
+    if(!(scaled > -32767.f)) {//also catches NaN
+        return scaled < 0.f ? -32767 : 0;
+    }
+    return scaled < 32767.f ? (int16_t)scaled : 32767;
+}
+
+static size_t grid_bucket(boids_world* world, size_t i) {
+    size_t cell = (size_t)grid_coord_y(world->y[i]) * (size_t)grid.width + (size_t)grid_coord_x(world->x[i]);
+    return grid.species_count > 1 ? cell * grid.species_count + species_index(world->species[i]) : cell;
+}
+
+//counting sort of every boid into its bucket, which gets a quarter of its boids and 2 more as
+//spare slots. Boids end up ascending inside each bucket since they are placed in array order.
+static bool grid_build_full(boids_world* world) {
+    for(size_t b = 0; b < grid.buckets_count; b++) {
+        grid.cell_end[b] = 0;
+    }
+    for(size_t i = 0; i < world->count; i++) {
+        grid.boid_cell[i] = grid_bucket(world, i);
+        grid.cell_end[grid.boid_cell[i]]++;
+    }
+    size_t slots_count = 0;
+    for(size_t b = 0; b < grid.buckets_count; b++) {
+        grid.cell_start[b] = slots_count;
+        slots_count += grid.cell_end[b] + grid.cell_end[b] / 4 + 2;
+        grid.cell_end[b] = grid.cell_start[b];
+    }
+    grid.cell_start[grid.buckets_count] = slots_count;
+    if(!grid_reserve(grid.buckets_count, slots_count > world->count ? slots_count : world->count)) {
+        return false;
+    }
+
+    for(size_t i = 0; i < world->count; i++) {
+        size_t k = grid.cell_end[grid.boid_cell[i]]++;
+        grid.items[k] = i;
+        grid.boid_slot[i] = k;
     }
+    grid.boids_count = world->count;
+    stats.grid_builds++;
+    return true;
 }
 
-static void separation(boid* b, boid* boids, size_t boids_count, hf_vec2f out_vec) {
-    boid neighbors[BOIDS_MAX_NEIGHBORS];
-    size_t neighbors_count;
-    boid_get_neighbors(b, boids, boids_count, 3.f, neighbors, &neighbors_count);
+static void grid_remove(size_t i) {
+    size_t bucket = grid.boid_cell[i];
+    for(size_t k = grid.boid_slot[i] + 1; k < grid.cell_end[bucket]; k++) {
+        grid.items[k - 1] = grid.items[k];
+        grid.boid_slot[grid.items[k - 1]] = k - 1;
+    }
+    grid.cell_end[bucket]--;
+}
+
+//inserts i in order, fails when the bucket has no spare slot left
+static bool grid_insert(size_t i, size_t bucket) {
+    if(grid.cell_end[bucket] == grid.cell_start[bucket + 1]) {
+        return false;
+    }
+    size_t k = grid.cell_end[bucket]++;
+    for(; k > grid.cell_start[bucket] && grid.items[k - 1] > i; k--) {
+        grid.items[k] = grid.items[k - 1];
+        grid.boid_slot[grid.items[k]] = k;
+    }
+    grid.items[k] = i;
+    grid.boid_slot[i] = k;
+    grid.boid_cell[i] = bucket;
+    return true;
+}
 
-    for(size_t i = 0; i < neighbors_count; i++) {
-        boid* other = &neighbors[i];
-        hf_vec2f from_other;
-        hf_vec2f_subtract(b->position, other->position, from_other);
-        hf_vec2f_normalize(from_other, from_other);
-        hf_vec2f_add(out_vec, from_other, out_vec);
+//moves the boids that changed bucket since the last update, boids past the old count are new
+//and the ones past the new count are gone. Fails when too many move or a bucket runs out of
+//spare slots, which leaves the grid for a full build to redo.
+static bool grid_migrate(boids_world* world) {
+    if(world->count > grid.items_capacity) {
+        return false;
+    }
+    for(size_t i = world->count; i < grid.boids_count; i++) {
+        grid_remove(i);
     }
 
-    if(neighbors_count) {
-        hf_vec2f_divide(out_vec, (float)neighbors_count, out_vec);
+    size_t limit = world->count / BOIDS_GRID_MIGRATION_DIVISOR;
+    size_t moved = 0;
+    for(size_t i = 0; i < world->count; i++) {
+        size_t bucket = grid_bucket(world, i);
+        if(i < grid.boids_count && bucket == grid.boid_cell[i]) {
+            continue;
+        }
+        if(++moved > limit) {
+            return false;
+        }
+        if(i < grid.boids_count) {
+            grid_remove(i);
+        }
+        if(!grid_insert(i, bucket)) {
+            return false;
+        }
     }
+    grid.boids_count = world->count;
+    stats.grid_migrations += moved;
+    return true;
 }
 
-static void alignment(boid* b, boid* boids, size_t boids_count, hf_vec2f out_vec) {
-    boid neighbors[BOIDS_MAX_NEIGHBORS];
-    size_t neighbors_count;
-    boid_get_neighbors(b, boids, boids_count, 7.f, neighbors, &neighbors_count);
+//buckets boids into cells, migrating them when the layout matches the last build. Cells wrap
+//around the bounds like positions do and are never smaller than cell_size, which keeps every
+//pair closer than that in adjacent cells.
+static void grid_build(boids_world* world, float cell_size, bool compact, bool partition) {
+    float width = floorf(period.x / cell_size);
+    float height = floorf(period.y / cell_size);
+    int grid_width = width >= 1.f ? (int)width : 1;
+    int grid_height = height >= 1.f ? (int)height : 1;
+    float cell_width = width >= 1.f ? period.x / width : cell_size;
+    float cell_height = height >= 1.f ? period.y / height : cell_size;
 
-    size_t c = 0;
-    for(size_t i = 0; i < neighbors_count; i++) {
-        boid* other = &neighbors[i];
-        if(other->id == b->id) {
-            hf_vec2f norm;
-            hf_vec2f_normalize(other->velocity, norm);
-            hf_vec2f_add(out_vec, norm, out_vec);
+    //only as many buckets per cell as the highest species present needs
+    size_t species_count = 1;
+    for(size_t i = 0; partition && i < world->count; i++) {
+        size_t species = species_index(world->species[i]);
+        species_count = species >= species_count ? species + 1 : species_count;
+    }
 
-            c++;
+    bool same_layout = grid.valid && grid_incremental && grid.min_x == bounds.min_x && grid.min_y == bounds.min_y
+        && grid.width == grid_width && grid.height == grid_height && grid.cell_width == cell_width
+        && grid.cell_height == cell_height && grid.species_count == species_count;
+    if(!same_layout || !grid_migrate(world)) {
+        grid.min_x = bounds.min_x;
+        grid.min_y = bounds.min_y;
+        grid.width = grid_width;
+        grid.height = grid_height;
+        grid.cell_width = cell_width;
+        grid.cell_height = cell_height;
+        grid.species_count = species_count;
+        grid.buckets_count = (size_t)grid_width * (size_t)grid_height * species_count;
+        grid.valid = grid_reserve(grid.buckets_count, world->count) && grid_build_full(world);
+        if(!grid.valid) {
+            return;
         }
     }
 
-    if(c) {
-        hf_vec2f_divide(out_vec, (float)c, out_vec);
+    grid.compact = compact && max_speed > 0.f && grid.width <= 65536 && grid.height <= 65536 && grid_reserve_compact(grid.items_capacity);
+    if(grid.compact) {
+        for(size_t i = 0; i < world->count; i++) {
+            grid_compact_boid* boid = &grid.boids_compact[i];
+            size_t cell = grid.boid_cell[i] / grid.species_count;
+            boid->column = (uint16_t)(cell % (size_t)grid.width);
+            boid->row = (uint16_t)(cell / (size_t)grid.width);
+            boid->x = quantize_cell(world->x[i], grid.min_x, grid.cell_width);
+            boid->y = quantize_cell(world->y[i], grid.min_y, grid.cell_height);
+            boid->vx = quantize_velocity(world->vx[i]);
+            boid->vy = quantize_velocity(world->vy[i]);
+            boid->species = (int16_t)world->species[i];
+
+            size_t k = grid.boid_slot[i];
+            grid.items_qx[k] = boid->x;
+            grid.items_qy[k] = boid->y;
+        }
     }
     else {
-        hf_vec2f_normalize(b->velocity, out_vec);
+        for(size_t i = 0; i < world->count; i++) {
+            size_t k = grid.boid_slot[i];
+            grid.items_x[k] = world->x[i];
+            grid.items_y[k] = world->y[i];
+        }
     }
 }
 
-static void cohesion(boid* b, boid* boids, size_t boids_count, hf_vec2f out_vec) {
-    boid neighbors[BOIDS_MAX_NEIGHBORS];
-    size_t neighbors_count;
-    boid_get_neighbors(b, boids, boids_count, 7.f, neighbors, &neighbors_count);
+//neighbor lists for the radii of every rule, filled by a single traversal per boid,
+//X(name, radius, radius for species that hunt). BOIDS_MAX_RADIUS has to cover all of them
+#define BOIDS_RADII(X)\
+    X(separation, 3.f, 3.f)\
+    X(flock, 7.f, 7.f)\
+    X(target, 10.f, 11.f)
 
-    hf_vec2f mid;
-    size_t c = 0;
-    for(size_t i = 0; i < neighbors_count; i++) {
-        boid* other = &neighbors[i];
-        if(other->id == b->id) {
-            hf_vec2f_add(mid, other->position, mid);
-            c++;
+#define RADIUS_ENUM(name, radius, hunting_radius) boids_radius_##name,
+enum {
+    BOIDS_RADII(RADIUS_ENUM)
+    boids_radius_count,
+};
+#undef RADIUS_ENUM
+
+typedef struct boid_neighbors_s {
+    float radius_sqr[boids_radius_count];
+    size_t indices[boids_radius_count][BOIDS_MAX_NEIGHBORS];
+    size_t counts[boids_radius_count];
+    size_t tests;//distances computed to fill the lists
+    unsigned int radii;//lists to fill, bit r for the list of radius r, the others stay empty
+    bool aggregated;//flock rules read the sums below, by species, and the flock list stays empty
+    size_t aggregate_species;
+    size_t aggregate_counts[BOIDS_MAX_SPECIES];
+    hf_vec2f aggregate_toward[BOIDS_MAX_SPECIES];//offsets from self
+    hf_vec2f aggregate_heading[BOIDS_MAX_SPECIES];//normalized velocities
+} boid_neighbors;
+
+#define BOIDS_RADII_ALL ((1u << boids_radius_count) - 1)
+
+//weights of the rule averages, see boids_set_interaction. radii caches which lists of a species
+//need boids of another, the buckets of a partitioned grid that need none are never visited.
+static struct {
+    bool ready;
+    float weights[boids_interaction_count][BOIDS_MAX_SPECIES][BOIDS_MAX_SPECIES];
+    bool any[boids_interaction_count][BOIDS_MAX_SPECIES];//some weight in the row
+    bool predator[BOIDS_MAX_SPECIES];//some species flees from it
+    bool any_predator;
+    unsigned int radii[BOIDS_MAX_SPECIES][BOIDS_MAX_SPECIES];//bit r for the list of radius r
+} interactions;
+
+static void interactions_update(void) {
+    interactions.any_predator = false;
+    for(size_t o = 0; o < BOIDS_MAX_SPECIES; o++) {
+        interactions.predator[o] = false;
+        for(size_t s = 0; s < BOIDS_MAX_SPECIES; s++) {
+            interactions.predator[o] |= interactions.weights[boids_interaction_flee][s][o] != 0.f;
+        }
+        interactions.any_predator |= interactions.predator[o];
+    }
+    for(size_t s = 0; s < BOIDS_MAX_SPECIES; s++) {
+        for(size_t i = 0; i < boids_interaction_count; i++) {
+            interactions.any[i][s] = false;
+            for(size_t o = 0; o < BOIDS_MAX_SPECIES; o++) {
+                interactions.any[i][s] |= interactions.weights[i][s][o] != 0.f;
+            }
+        }
+        for(size_t o = 0; o < BOIDS_MAX_SPECIES; o++) {
+            unsigned int radii = 0;
+            radii |= interactions.weights[boids_interaction_separation][s][o] != 0.f ? 1u << boids_radius_separation : 0;
+            radii |= interactions.weights[boids_interaction_flock][s][o] != 0.f ? 1u << boids_radius_flock : 0;
+            radii |= interactions.weights[boids_interaction_hunt][s][o] != 0.f ? 1u << boids_radius_target : 0;
+            radii |= interactions.weights[boids_interaction_flee][s][o] != 0.f ? 1u << boids_radius_target : 0;
+            interactions.radii[s][o] = radii;
         }
     }
+    interactions.ready = true;
+}
 
-    if(c) {
-        hf_vec2f_divide(mid, (float)c, mid);
+void boids_reset_interactions(void) {
+    for(size_t s = 0; s < BOIDS_MAX_SPECIES; s++) {
+        for(size_t o = 0; o < BOIDS_MAX_SPECIES; o++) {
+            interactions.weights[boids_interaction_separation][s][o] = 1.f;
+            interactions.weights[boids_interaction_flock][s][o] = s == o ? 1.f : 0.f;
+            interactions.weights[boids_interaction_hunt][s][o] = s == 4 && o != 4 ? 1.f : 0.f;
+            interactions.weights[boids_interaction_flee][s][o] = s != 4 && o == 4 ? 1.f : 0.f;
+        }
     }
-    else {
-        hf_vec2f_copy(b->position, mid);
+    interactions_update();
+}
+
+void boids_set_interaction(boids_interaction interaction, int species, int other, float weight) {
+    if(!interactions.ready) {
+        boids_reset_interactions();
+    }
+    if((unsigned int)interaction < boids_interaction_count) {
+        interactions.weights[interaction][species_index(species)][species_index(other)] = weight;
+        interactions_update();
+    }
+}
+
+//boids of the species something flees from, as their positions in the grid items with their
+//cells, both ascending. Prey look for targets only here, predators are few, and their grid scans
+//can stop once the separation and flock lists are full instead of walking the whole block.
+static struct {
+    size_t* slots;
+    size_t* cells;
+    size_t count;
+    size_t capacity;
+    bool valid;
+} predators;
+
+static bool predators_reserve(size_t count) {
+    if(count <= predators.capacity) {
+        return true;
+    }
+    size_t capacity = predators.capacity ? predators.capacity : 64;
+    while(capacity < count) {
+        capacity *= 2;
     }
 
-    hf_vec2f_subtract(mid, b->position, out_vec);
+    size_t* new_memory = realloc(predators.slots, capacity * sizeof(size_t));
+    if(!new_memory) {
+        return false;
+    }
+    predators.slots = new_memory;
+    new_memory = realloc(predators.cells, capacity * sizeof(size_t));
+    if(!new_memory) {
+        return false;
+    }
+    predators.cells = new_memory;
+    predators.capacity = capacity;
+    return true;
 }
 
-static void hunt(boid* b, boid* boids, size_t boids_count, hf_vec2f out_vec) {
-    boid neighbors[BOIDS_MAX_NEIGHBORS];
-    size_t neighbors_count;
-    boid_get_neighbors(b, boids, boids_count, 11.f, neighbors, &neighbors_count);
+//expects a grid just built from world. A species partitioned grid already keeps predators in
+//buckets of their own, which prey find as cheaply, so it goes without the index
+static void predators_build(boids_world* world) {
+    predators.count = 0;
+    predators.valid = grid.valid && grid.species_count == 1;
+    for(size_t b = 0; predators.valid && interactions.any_predator && b < grid.buckets_count; b++) {
+        for(size_t k = grid.cell_start[b]; predators.valid && k < grid.cell_end[b]; k++) {
+            size_t i = grid.items[k];
+            if(!interactions.predator[species_index(world->species[i])]) {
+                continue;
+            }
+            predators.valid = predators_reserve(predators.count + 1);
+            if(predators.valid) {
+                predators.slots[predators.count] = k;
+                predators.cells[predators.count] = b;
+                predators.count++;
+            }
+        }
+    }
+}
 
-    hf_vec2f mid;
-    size_t c = 0;
-    for(size_t i = 0; i < neighbors_count; i++) {
-        boid* other = &neighbors[i];
-        if(other->id != b->id) {
-            hf_vec2f_add(mid, other->position, mid);
-            c++;
+static size_t predators_lower_bound(size_t cell) {
+    size_t begin = 0;
+    size_t end = predators.count;
+    while(begin < end) {
+        size_t mid = begin + (end - begin) / 2;
+        if(predators.cells[mid] < cell) {
+            begin = mid + 1;
+        }
+        else {
+            end = mid;
         }
     }
+    return begin;
+}
 
-    if(c) {
-        hf_vec2f_divide(mid, (float)c, mid);
+//inserts index into the ascending list of the smallest BOIDS_MAX_NEIGHBORS indices found so far
+static void neighbors_insert(size_t* indices, size_t* count, size_t index) {
+    if(*count >= BOIDS_MAX_NEIGHBORS && index > indices[BOIDS_MAX_NEIGHBORS - 1]) {
+        return;
     }
-    else {
-        hf_vec2f_copy(b->position, mid);
+    size_t i = *count < BOIDS_MAX_NEIGHBORS ? (*count)++ : BOIDS_MAX_NEIGHBORS - 1;
+    while(i > 0 && indices[i - 1] > index) {
+        indices[i] = indices[i - 1];
+        i--;
+    }
+    indices[i] = index;
+}
+
+//lists outside radii count as full
+static bool neighbors_full_radii(boid_neighbors* neighbors, unsigned int radii) {
+    for(size_t r = 0; r < boids_radius_count; r++) {
+        if((radii & (1u << r)) && neighbors->counts[r] < BOIDS_MAX_NEIGHBORS) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void neighbors_test(boid_neighbors* neighbors, const float* radius_sqr, hf_vec2f position, boids_world* world, size_t index) {
+    hf_vec2f offset;
+    wrap_offset(position[0] - world->x[index], position[1] - world->y[index], offset);
+    float dist_sqr = offset[0] * offset[0] + offset[1] * offset[1];
+    for(size_t r = 0; r < boids_radius_count; r++) {
+        if(dist_sqr < radius_sqr[r]) {
+            neighbors_insert(neighbors->indices[r], &neighbors->counts[r], index);
+        }
     }
+}
+
+#ifdef BOIDS_SIMD_WIDTH
+//loads lanes values[indices[0..BOIDS_SIMD_WIDTH)], built with set instead of a store and reload
+//of a lane array, which would stall on store forwarding
+#if BOIDS_SIMD_WIDTH == 8
+#define simd_gather(values, indices) _mm256_setr_ps(\
+    (float)(values)[(indices)[0]], (float)(values)[(indices)[1]], (float)(values)[(indices)[2]], (float)(values)[(indices)[3]],\
+    (float)(values)[(indices)[4]], (float)(values)[(indices)[5]], (float)(values)[(indices)[6]], (float)(values)[(indices)[7]])
+#else
+#define simd_gather(values, indices) _mm_setr_ps(\
+    (float)(values)[(indices)[0]], (float)(values)[(indices)[1]], (float)(values)[(indices)[2]], (float)(values)[(indices)[3]])
+#endif
 
-    hf_vec2f_subtract(mid, b->position, out_vec);
+//copies up to BOIDS_SIMD_WIDTH indices, repeating the last one into unused lanes, and returns the used lane count
+static size_t simd_batch(const size_t* indices, size_t count, size_t* out_batch) {
+    size_t lanes = count < BOIDS_SIMD_WIDTH ? count : BOIDS_SIMD_WIDTH;
+    for(size_t l = 0; l < BOIDS_SIMD_WIDTH; l++) {
+        out_batch[l] = indices[l < lanes ? l : lanes - 1];
+    }
+    return lanes;
 }
 
-static void flee(boid* b, boid* boids, size_t boids_count, hf_vec2f out_vec) {
-    boid neighbors[BOIDS_MAX_NEIGHBORS];
-    size_t neighbors_count;
-    boid_get_neighbors(b, boids, boids_count, 10.f, neighbors, &neighbors_count);
+//same as wrap_offset, per lane
+static simd_float simd_wrap(simd_float delta, float size, float inv_size) {
+    return simd_sub(delta, simd_mul(simd_set1(size), simd_round(simd_mul(delta, simd_set1(inv_size)))));
+}
 
-    hf_vec2f_copy((hf_vec2f) { 0 }, out_vec);
-    size_t c = 0;
-    for(size_t i = 0; i < neighbors_count; i++) {
-        boid* other = &neighbors[i];
-        if(other->id == 4) {
-            hf_vec2f from_other;
-            hf_vec2f_subtract(b->position, other->position, from_other);
-            hf_vec2f_normalize(from_other, from_other);
-            hf_vec2f_add(out_vec, from_other, out_vec);
-            c++;
+//inserts the lanes of indices closer than each radius
+static void neighbors_insert_lanes(boid_neighbors* neighbors, simd_float dist_sqr, const simd_float* radius_sqr, const size_t* indices, size_t self) {
+    int masks[boids_radius_count];
+    int any = 0;
+    for(size_t r = 0; r < boids_radius_count; r++) {
+        masks[r] = simd_mask(simd_less(dist_sqr, radius_sqr[r]));
+        any |= masks[r];
+    }
+    for(size_t l = 0; any; l++, any >>= 1) {
+        if(!(any & 1) || indices[l] == self) {
+            continue;
+        }
+        for(size_t r = 0; r < boids_radius_count; r++) {
+            if(masks[r] & (1 << l)) {
+                neighbors_insert(neighbors->indices[r], &neighbors->counts[r], indices[l]);
+            }
         }
     }
+}
+#endif
+
+//tests the grid items in [begin, end) against radius_sqr, which stands in for the radii of
+//neighbors, a batch of lanes at a time when SIMD is on. Lanes are only split back into scalar
+//inserts when one of them is inside some radius.
+static void neighbors_test_run(boid_neighbors* neighbors, const float* radius_sqr, hf_vec2f position, boids_world* world, size_t begin, size_t end, size_t self) {
+    neighbors->tests += end - begin;
+#ifdef BOIDS_SIMD_WIDTH
+    if(simd_enabled) {
+        simd_float px = simd_set1(position[0]);
+        simd_float py = simd_set1(position[1]);
+        simd_float lanes_radius_sqr[boids_radius_count];
+        for(size_t r = 0; r < boids_radius_count; r++) {
+            lanes_radius_sqr[r] = simd_set1(radius_sqr[r]);
+        }
 
-    if(c) {
-        hf_vec2f_divide(out_vec, (float)c, out_vec);
+        size_t k = begin;
+        for(; k + BOIDS_SIMD_WIDTH <= end; k += BOIDS_SIMD_WIDTH) {
+            simd_float dx = simd_wrap(simd_sub(px, simd_loadu(&grid.items_x[k])), period.x, period.inv_x);
+            simd_float dy = simd_wrap(simd_sub(py, simd_loadu(&grid.items_y[k])), period.y, period.inv_y);
+            simd_float dist_sqr = simd_add(simd_mul(dx, dx), simd_mul(dy, dy));
+
+            neighbors_insert_lanes(neighbors, dist_sqr, lanes_radius_sqr, &grid.items[k], self);
+        }
+        begin = k;//the tail goes through the scalar test
+    }
+#endif
+    for(size_t k = begin; k < end; k++) {
+        if(grid.items[k] != self) {
+            neighbors_test(neighbors, radius_sqr, position, world, grid.items[k]);
+        }
     }
 }
 
-static void apply_func(boid* b, boid* boids, size_t boids_count, void(*func)(boid*, boid*, size_t, hf_vec2f), float intensity) {
-    hf_vec2f res = { 0 };
-    func(b, boids, boids_count, res);
-    hf_vec2f_multiply(res, intensity, res);
-    hf_vec2f_add(b->acceleration, res, b->acceleration);
+//offset from position to the first quantum center of a cell, compact items are this plus their quantized position
+static void grid_compact_base(int column, int row, hf_vec2f position, hf_vec2f out_base) {
+    out_base[0] = grid.min_x + (float)column * grid.cell_width + grid.cell_width * (.5f / 65536.f) - position[0];
+    out_base[1] = grid.min_y + (float)row * grid.cell_height + grid.cell_height * (.5f / 65536.f) - position[1];
+}
+
+static void grid_compact_offset(hf_vec2f base, uint16_t x, uint16_t y, hf_vec2f out_offset) {
+    wrap_offset(base[0] + (float)x * (grid.cell_width / 65536.f), base[1] + (float)y * (grid.cell_height / 65536.f), out_offset);
+}
+
+//neighbors_test_run for compact items, [begin, end) has to be inside cell
+static void neighbors_test_run_compact(boid_neighbors* neighbors, const float* radius_sqr, hf_vec2f position, size_t cell, size_t begin, size_t end, size_t self) {
+    neighbors->tests += end - begin;
+    hf_vec2f base;
+    grid_compact_base((int)(cell % (size_t)grid.width), (int)(cell / (size_t)grid.width), position, base);
+#ifdef BOIDS_SIMD_WIDTH
+    if(simd_enabled) {
+        simd_float base_x = simd_set1(base[0]);
+        simd_float base_y = simd_set1(base[1]);
+        simd_float scale_x = simd_set1(grid.cell_width / 65536.f);
+        simd_float scale_y = simd_set1(grid.cell_height / 65536.f);
+        simd_float lanes_radius_sqr[boids_radius_count];
+        for(size_t r = 0; r < boids_radius_count; r++) {
+            lanes_radius_sqr[r] = simd_set1(radius_sqr[r]);
+        }
+
+        size_t k = begin;
+        for(; k + BOIDS_SIMD_WIDTH <= end; k += BOIDS_SIMD_WIDTH) {
+            simd_float dx = simd_wrap(simd_add(base_x, simd_mul(simd_load_u16(&grid.items_qx[k]), scale_x)), period.x, period.inv_x);
+            simd_float dy = simd_wrap(simd_add(base_y, simd_mul(simd_load_u16(&grid.items_qy[k]), scale_y)), period.y, period.inv_y);
+            simd_float dist_sqr = simd_add(simd_mul(dx, dx), simd_mul(dy, dy));
+
+            neighbors_insert_lanes(neighbors, dist_sqr, lanes_radius_sqr, &grid.items[k], self);
+        }
+        begin = k;
+    }
+#endif
+    for(size_t k = begin; k < end; k++) {
+        if(grid.items[k] == self) {
+            continue;
+        }
+        hf_vec2f offset;
+        grid_compact_offset(base, grid.items_qx[k], grid.items_qy[k], offset);
+        float dist_sqr = offset[0] * offset[0] + offset[1] * offset[1];
+        for(size_t r = 0; r < boids_radius_count; r++) {
+            if(dist_sqr < radius_sqr[r]) {
+                neighbors_insert(neighbors->indices[r], &neighbors->counts[r], grid.items[k]);
+            }
+        }
+    }
 }
 
-void boids_update(boid* boids, size_t boids_count, float delta) {
-    for(size_t i = 0; i < boids_count; i++) {
-        boid* b = &boids[i];
+//tests an ascending index list without self, which can stop as soon as every radius is full
+static void neighbors_test_list(boid_neighbors* neighbors, hf_vec2f position, boids_world* world, const size_t* items, size_t count) {
+    size_t k = 0;
+#ifdef BOIDS_SIMD_WIDTH
+    if(simd_enabled) {
+        simd_float px = simd_set1(position[0]);
+        simd_float py = simd_set1(position[1]);
+        simd_float radius_sqr[boids_radius_count];
+        for(size_t r = 0; r < boids_radius_count; r++) {
+            radius_sqr[r] = simd_set1(neighbors->radius_sqr[r]);
+        }
+
+        for(; k + BOIDS_SIMD_WIDTH <= count && !neighbors_full_radii(neighbors, neighbors->radii); k += BOIDS_SIMD_WIDTH) {
+            simd_float dx = simd_wrap(simd_sub(px, simd_gather(world->x, &items[k])), period.x, period.inv_x);
+            simd_float dy = simd_wrap(simd_sub(py, simd_gather(world->y, &items[k])), period.y, period.inv_y);
+            simd_float dist_sqr = simd_add(simd_mul(dx, dx), simd_mul(dy, dy));
+
+            neighbors_insert_lanes(neighbors, dist_sqr, radius_sqr, &items[k], SIZE_MAX);
+        }
+    }
+#endif
+    for(; k < count && !neighbors_full_radii(neighbors, neighbors->radii); k++) {
+        neighbors_test(neighbors, neighbors->radius_sqr, position, world, items[k]);
+    }
+    neighbors->tests += k;
+}
 
-        apply_func(b, boids, boids_count, separation, 4.f);
-        apply_func(b, boids, boids_count, alignment, .8f);
-        apply_func(b, boids, boids_count, cohesion, 0.5f);
-        if(b->id == 4) {
-            apply_func(b, boids, boids_count, hunt, 5.f);
+//first position in [begin, end) whose item is not below limit
+static size_t grid_items_lower_bound(size_t begin, size_t end, size_t limit) {
+    while(begin < end) {
+        size_t mid = begin + (end - begin) / 2;
+        if(grid.items[mid] < limit) {
+            begin = mid + 1;
         }
         else {
-            apply_func(b, boids, boids_count, flee, 5.f);
+            end = mid;
         }
     }
-    for(size_t i = 0; i < boids_count; i++) {
-        boid* b = &boids[i];
+    return begin;
+}
 
-        hf_vec2f delta_acc;
-        hf_vec2f_multiply(b->acceleration, delta * 2.f, delta_acc);
-        hf_vec2f_add(b->velocity, delta_acc, b->velocity);
+//fills the target list of self with the predators of the block it flees from
+static void predators_get_targets(boids_world* world, size_t self, hf_vec2f position, const size_t* cells, size_t cells_count, boid_neighbors* neighbors) {
+    const unsigned int* species_radii = interactions.radii[species_index(world->species[self])];
+    for(size_t c = 0; c < cells_count; c++) {
+        hf_vec2f base;
+        grid_compact_base((int)(cells[c] % (size_t)grid.width), (int)(cells[c] / (size_t)grid.width), position, base);
+        for(size_t j = predators_lower_bound(cells[c]); j < predators.count && predators.cells[j] == cells[c]; j++) {
+            size_t k = predators.slots[j];
+            size_t other = grid.items[k];
+            if(other == self || !(species_radii[species_index(world->species[other])] & (1u << boids_radius_target))) {
+                continue;
+            }
 
-        if(hf_vec2f_square_magnitude(b->velocity) > (max_speed * max_speed)) {
-            hf_vec2f_normalize(b->velocity, b->velocity);
-            hf_vec2f_multiply(b->velocity, max_speed, b->velocity);
+            hf_vec2f offset;
+            if(grid.compact) {
+                grid_compact_offset(base, grid.items_qx[k], grid.items_qy[k], offset);
+            }
+            else {
+                wrap_offset(position[0] - grid.items_x[k], position[1] - grid.items_y[k], offset);
+            }
+            if(offset[0] * offset[0] + offset[1] * offset[1] < neighbors->radius_sqr[boids_radius_target]) {
+                neighbors_insert(neighbors->indices[boids_radius_target], &neighbors->counts[boids_radius_target], other);
+            }
+            neighbors->tests++;
         }
+    }
+}
+
+//visits the 3x3 cell block around self in windows of ascending boid index. Cells are sorted
+//too, so the walk can stop as soon as a window fills every list, and each list holds exactly
+//the first BOIDS_MAX_NEIGHBORS matches in array order, as a full scan would find. In a species
+//partitioned grid only the buckets some list of self needs are walked, each for those lists alone.
+static void grid_get_neighbors(boids_world* world, size_t self, boid_neighbors* neighbors) {
+    hf_vec2f position = { world->x[self], world->y[self] };
+    size_t cells[9];
+    size_t cells_count = grid_block(position[0], position[1], cells);
 
-        hf_vec2f movement;
-        hf_vec2f_multiply(b->velocity, delta, movement);
-        hf_vec2f_add(b->position, movement, b->position);
+    //boids that do not hunt only target predators, which come from their own index
+    size_t species = species_index(world->species[self]);
+    unsigned int scan_radii = neighbors->radii;
+    if(predators.valid && !interactions.any[boids_interaction_hunt][species] && (scan_radii & (1u << boids_radius_target))) {
+        predators_get_targets(world, self, position, cells, cells_count, neighbors);
+        scan_radii &= ~(1u << boids_radius_target);
+    }
 
-        float bounds_width = bounds.max_x - bounds.min_x;
-        float bounds_height = bounds.max_y - bounds.min_y;
-        if(b->position[0] > bounds.max_x) {
-            b->position[0] -= bounds_width;
+    //radius_sqr of the lists in each mask of radii, the others get 0 which no distance is below
+    float masked_radius_sqr[BOIDS_RADII_ALL + 1][boids_radius_count];
+    const unsigned int* species_radii = interactions.radii[species];
+    if(grid.species_count > 1 || scan_radii != BOIDS_RADII_ALL) {
+        for(unsigned int m = 0; m <= BOIDS_RADII_ALL; m++) {
+            for(size_t r = 0; r < boids_radius_count; r++) {
+                masked_radius_sqr[m][r] = m & (1u << r) ? neighbors->radius_sqr[r] : 0.f;
+            }
         }
-        else if(b->position[0] < bounds.min_x) {
-            b->position[0] += bounds_width;
+    }
+
+    size_t cursors[9 * BOIDS_MAX_SPECIES];
+    size_t ends[9 * BOIDS_MAX_SPECIES];
+    size_t range_cells[9 * BOIDS_MAX_SPECIES];
+    const float* range_radius_sqr[9 * BOIDS_MAX_SPECIES];
+    size_t ranges_count = 0;
+    size_t candidates_count = 0;
+    unsigned int radii = 0;
+    //cells beyond the widest list left to fill hold nothing for any of them
+    float reach_sqr = 0.f;
+    for(size_t r = 0; r < boids_radius_count; r++) {
+        reach_sqr = scan_radii & (1u << r) ? fmaxf(reach_sqr, neighbors->radius_sqr[r]) : reach_sqr;
+    }
+    for(size_t c = 0; c < cells_count; c++) {
+        if(grid_cell_distance_sqr(cells[c], position) >= reach_sqr) {
+            continue;
         }
-        if(b->position[1] > bounds.max_y) {
-            b->position[1] -= bounds_height;
+        for(size_t o = 0; o < grid.species_count; o++) {
+            unsigned int range_radii = grid.species_count > 1 ? species_radii[o] & scan_radii : scan_radii;
+            size_t bucket = cells[c] * grid.species_count + o;
+            if(!range_radii || grid.cell_start[bucket] == grid.cell_end[bucket]) {
+                continue;
+            }
+            cursors[ranges_count] = grid.cell_start[bucket];
+            ends[ranges_count] = grid.cell_end[bucket];
+            range_cells[ranges_count] = cells[c];
+            range_radius_sqr[ranges_count] = range_radii != BOIDS_RADII_ALL ? masked_radius_sqr[range_radii] : neighbors->radius_sqr;
+            candidates_count += ends[ranges_count] - cursors[ranges_count];
+            radii |= range_radii;
+            ranges_count++;
         }
-        else if(b->position[1] < bounds.min_y) {
-            b->position[1] += bounds_height;
+    }
+
+    //sparse blocks are cheaper to walk in one go
+    size_t windows = candidates_count / (BOIDS_MAX_NEIGHBORS * 4);
+    if(windows > BOIDS_GRID_WINDOWS) {
+        windows = BOIDS_GRID_WINDOWS;
+    }
+    size_t window = world->count / (windows + 1) + 1;
+    for(size_t limit = window; !neighbors_full_radii(neighbors, radii) && limit < world->count + window; limit += window) {
+        for(size_t r = 0; r < ranges_count; r++) {
+            size_t k = grid_items_lower_bound(cursors[r], ends[r], limit);
+            if(grid.compact) {
+                neighbors_test_run_compact(neighbors, range_radius_sqr[r], position, range_cells[r], cursors[r], k, self);
+            }
+            else {
+                neighbors_test_run(neighbors, range_radius_sqr[r], position, world, cursors[r], k, self);
+            }
+            cursors[r] = k;
         }
+    }
+}
+
+//verlet neighbor lists: every boid within BOIDS_MAX_RADIUS + skin at build time, ascending.
+//While no boid has moved more than half the skin since then, every pair closer than
+//BOIDS_MAX_RADIUS is still in the lists, so scanning them gives the same neighbors as the grid.
+static struct {
+    bool enabled;
+    float skin;
+    bool valid;
+    float build_skin;//of the lists as built, the setting or the skin of a boids_world_update_steps batch
+    size_t* start;//count + 1 entries
+    size_t* items;
+    bool* overflow;//more than BOIDS_VERLET_MAX_CANDIDATES candidates, queries the grid instead
+    float* build_x;
+    float* build_y;
+    size_t overflow_count;
+    size_t count;
+    size_t capacity;
+    size_t items_capacity;
+} verlet;
+
+void boids_set_neighbor_lists(bool enabled, float skin) {
+    verlet.enabled = enabled;
+    verlet.skin = skin > 0.f ? skin : 0.f;
+    verlet.valid = false;
+}
+
+static bool verlet_reserve(size_t count) {
+    if(count <= verlet.capacity) {
+        return true;
+    }
+    size_t* new_start = realloc(verlet.start, (count + 1) * sizeof(size_t));
+    if(!new_start) {
+        return false;
+    }
+    verlet.start = new_start;
+
+    bool* new_overflow = realloc(verlet.overflow, count * sizeof(bool));
+    if(!new_overflow) {
+        return false;
+    }
+    verlet.overflow = new_overflow;
+
+    float* new_build_x = realloc(verlet.build_x, count * sizeof(float));
+    if(!new_build_x) {
+        return false;
+    }
+    verlet.build_x = new_build_x;
 
-        //reset acceleration
-        hf_vec2f_copy((hf_vec2f) { 0 }, b->acceleration);
+    float* new_build_y = realloc(verlet.build_y, count * sizeof(float));
+    if(!new_build_y) {
+        return false;
     }
+    verlet.build_y = new_build_y;
+    verlet.capacity = count;
+    return true;
 }
 
-static hf_vec3f colors[] = {
-    { 0.f, 0.f, 0.f },
-    { .3f, .3f, .3f },
-    { .7f, .7f, .7f },
-    { 1.f, 1.f, 1.f },
-    { 1.f, .2f, .2f },
-};
+static bool verlet_needs_build(boids_world* world, float skin) {
+    if(!verlet.valid || verlet_world != world->memory || verlet.count != world->count || verlet.build_skin != skin) {
+        return true;
+    }
+    float limit = verlet.build_skin * .5f;
+    for(size_t i = 0; i < world->count; i++) {
+        hf_vec2f moved;
+        wrap_offset(world->x[i] - verlet.build_x[i], world->y[i] - verlet.build_y[i], moved);
+        if(moved[0] * moved[0] + moved[1] * moved[1] > limit * limit) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int compare_index(const void* a, const void* b) {
+    size_t index_a = *(const size_t*)a;
+    size_t index_b = *(const size_t*)b;
+    return (index_a > index_b) - (index_a < index_b);
+}
 
-void boids_draw(boid* boids, size_t size, hfe_mesh mesh) {
-    hfe_mesh_use(mesh);
-    for (size_t i = 0; i < size; i++) {
-        boid b = boids[i];
+//candidates of self in the 3x3 block, ascending. Returns BOIDS_VERLET_MAX_CANDIDATES + 1 on overflow.
+static size_t verlet_collect(boids_world* world, size_t self, size_t* out_items, size_t* out_tests) {
+    float radius = BOIDS_MAX_RADIUS + verlet.build_skin;
+    size_t cells[9];
+    size_t cells_count = grid_block(world->x[self], world->y[self], cells);
 
-        hf_mat4f mat_rot;
-        hf_transform3f_rotation_z(atan2f(-b.velocity[1], b.velocity[0]) + 3.1415f / 2.f, mat_rot);
+    size_t count = 0;
+    for(size_t c = 0; c < cells_count; c++) {
+        for(size_t k = grid.cell_start[cells[c]]; k < grid.cell_end[cells[c]]; k++) {
+            (*out_tests)++;
+            hf_vec2f offset;
+            wrap_offset(world->x[self] - grid.items_x[k], world->y[self] - grid.items_y[k], offset);
+            if(grid.items[k] == self || offset[0] * offset[0] + offset[1] * offset[1] >= radius * radius) {
+                continue;
+            }
+            if(count >= BOIDS_VERLET_MAX_CANDIDATES) {
+                return BOIDS_VERLET_MAX_CANDIDATES + 1;
+            }
+            out_items[count++] = grid.items[k];
+        }
+    }
+    qsort(out_items, count, sizeof(size_t), compare_index);
+    return count;
+}
 
-        hf_mat4f mat_tra;
-        hf_transform3f_translation((hf_vec3f) { b.position[0], b.position[1], 0.f }, mat_tra);
+static void verlet_count(size_t begin, size_t end, void* context) {
+    boids_world* world = context;
+    size_t items[BOIDS_VERLET_MAX_CANDIDATES];
+    size_t tests_count = 0;
+    for(size_t i = begin; i < end; i++) {
+        size_t count = verlet_collect(world, i, items, &tests_count);
+        verlet.overflow[i] = count > BOIDS_VERLET_MAX_CANDIDATES;
+        verlet.start[i + 1] = verlet.overflow[i] ? 0 : count;
+    }
+    tests_add(begin, tests_count);
+}
 
-        hf_mat4f mat_model;
-        hf_mat4f_multiply_mat4f(mat_tra, mat_rot, mat_model);
+static void verlet_fill(size_t begin, size_t end, void* context) {
+    boids_world* world = context;
+    size_t tests_count = 0;
+    for(size_t i = begin; i < end; i++) {
+        if(!verlet.overflow[i]) {
+            verlet_collect(world, i, &verlet.items[verlet.start[i]], &tests_count);
+        }
+        verlet.build_x[i] = world->x[i];
+        verlet.build_y[i] = world->y[i];
+    }
+    tests_add(begin, tests_count);
+}
 
-        hfe_shader_property_set_mat4f(hfe_shader_property_get("u_Model"), mat_model[0]);
-        hf_vec3f color;
-        hf_vec3f_copy(colors[(unsigned int)b.id % (sizeof(colors) / sizeof(colors[0]))], color);
-        hfe_shader_property_set_3f(hfe_shader_property_get("u_Color"), color[0], color[1], color[2]);
-        hfe_mesh_draw();
+//expects a grid built with cells of at least BOIDS_MAX_RADIUS + skin
+static void verlet_build(boids_world* world, float skin) {
+    verlet.valid = false;
+    if(!grid.valid || !verlet_reserve(world->count)) {
+        return;
+    }
+    verlet.build_skin = skin;
+
+    verlet.start[0] = 0;
+    boids_parallel_for(world->count, BOIDS_UPDATE_CHUNK, verlet_count, world);
+    verlet.overflow_count = 0;
+    for(size_t i = 0; i < world->count; i++) {
+        verlet.start[i + 1] += verlet.start[i];
+        verlet.overflow_count += verlet.overflow[i];
+    }
+
+    size_t items_count = verlet.start[world->count];
+    if(items_count > verlet.items_capacity) {
+        size_t* new_items = realloc(verlet.items, items_count * sizeof(size_t));
+        if(!new_items) {
+            return;
+        }
+        verlet.items = new_items;
+        verlet.items_capacity = items_count;
+    }
+    boids_parallel_for(world->count, BOIDS_UPDATE_CHUNK, verlet_fill, world);
+
+    verlet.count = world->count;
+    verlet.valid = true;
+    verlet_world = world->memory;
+    stats.neighbor_list_builds++;
+}
+
+//fills the target list of self with the predators of its neighbor list, the ones the grid finds through its index
+static void verlet_get_targets(boids_world* world, size_t self, hf_vec2f position, const size_t* items, size_t count, boid_neighbors* neighbors) {
+    const unsigned int* species_radii = interactions.radii[species_index(world->species[self])];
+    size_t k = 0;
+    for(; k < count && neighbors->counts[boids_radius_target] < BOIDS_MAX_NEIGHBORS; k++) {
+        size_t other = items[k];
+        if(!(species_radii[species_index(world->species[other])] & (1u << boids_radius_target))) {
+            continue;
+        }
+        hf_vec2f offset;
+        wrap_offset(position[0] - world->x[other], position[1] - world->y[other], offset);
+        if(offset[0] * offset[0] + offset[1] * offset[1] < neighbors->radius_sqr[boids_radius_target]) {
+            neighbors_insert(neighbors->indices[boids_radius_target], &neighbors->counts[boids_radius_target], other);
+        }
+    }
+    neighbors->tests += k;
+}
+
+//k nearest mode: a kd-tree over the positions, rebuilt every update. Every node splits its range in
+//half at the median of its wider axis, children of node n are 2n + 1 and 2n + 2 and all leaves sit
+//on the last level, so the tree is stored flat and each level can be split in parallel.
+typedef struct kd_point_s {
+    float x;
+    float y;
+    size_t index;
+} kd_point;
+
+typedef struct kd_node_s {
+    float min_x;
+    float min_y;
+    float max_x;
+    float max_y;
+    size_t begin;
+    size_t end;
+} kd_node;
+
+static struct {
+    bool enabled;
+    size_t k;
+    bool valid;
+    kd_point* points;
+    kd_node* nodes;
+    size_t depth;
+    size_t capacity;
+    size_t nodes_capacity;
+} kd;
+
+void boids_set_nearest_neighbors(bool enabled, size_t k) {
+    kd.enabled = enabled;
+    kd.k = k < 1 ? 1 : (k > BOIDS_MAX_NEIGHBORS ? BOIDS_MAX_NEIGHBORS : k);
+}
+
+static bool kd_reserve(size_t count, size_t nodes_count) {
+    if(count > kd.capacity) {
+        kd_point* new_points = realloc(kd.points, count * sizeof(kd_point));
+        if(!new_points) {
+            return false;
+        }
+        kd.points = new_points;
+        kd.capacity = count;
+    }
+    if(nodes_count > kd.nodes_capacity) {
+        kd_node* new_nodes = realloc(kd.nodes, nodes_count * sizeof(kd_node));
+        if(!new_nodes) {
+            return false;
+        }
+        kd.nodes = new_nodes;
+        kd.nodes_capacity = nodes_count;
+    }
+    return true;
+}
+
+static float kd_coord(const kd_point* point, bool axis_y) {
+    return axis_y ? point->y : point->x;
+}
+
+//quickselect, leaves the nth smallest coordinate at nth with nothing larger before it and nothing smaller after it
+static void kd_select(size_t begin, size_t end, size_t nth, bool axis_y) {
+    while(end - begin > 1) {
+        float pivot = kd_coord(&kd.points[begin + (end - begin - 1) / 2], axis_y);
+        size_t lo = begin;
+        size_t hi = end;
+        while(true) {
+            while(kd_coord(&kd.points[lo], axis_y) < pivot) {
+                lo++;
+            }
+            do {
+                hi--;
+            } while(kd_coord(&kd.points[hi], axis_y) > pivot);
+            if(lo >= hi) {
+                break;
+            }
+            kd_point swap = kd.points[lo];
+            kd.points[lo] = kd.points[hi];
+            kd.points[hi] = swap;
+            lo++;
+        }
+        //[begin, hi] is not above the pivot and (hi, end) not below it
+        if(nth <= hi) {
+            end = hi + 1;
+        }
+        else {
+            begin = hi + 1;
+        }
+    }
+}
+
+static void kd_points_fill(size_t begin, size_t end, void* context) {
+    boids_world* world = context;
+    for(size_t i = begin; i < end; i++) {
+        kd.points[i] = (kd_point) { world->x[i], world->y[i], i };
+    }
+}
+
+//bounds the nodes of one level and splits their ranges between their children
+static void kd_split(size_t begin, size_t end, void* context) {
+    size_t level = *(size_t*)context;
+    size_t first = ((size_t)1 << level) - 1;
+    for(size_t n = first + begin; n < first + end; n++) {
+        kd_node* node = &kd.nodes[n];
+        node->min_x = node->max_x = kd.points[node->begin].x;
+        node->min_y = node->max_y = kd.points[node->begin].y;
+        for(size_t i = node->begin + 1; i < node->end; i++) {
+            node->min_x = fminf(node->min_x, kd.points[i].x);
+            node->min_y = fminf(node->min_y, kd.points[i].y);
+            node->max_x = fmaxf(node->max_x, kd.points[i].x);
+            node->max_y = fmaxf(node->max_y, kd.points[i].y);
+        }
+        if(level == kd.depth) {
+            continue;
+        }
+
+        size_t mid = node->begin + (node->end - node->begin) / 2;
+        kd_select(node->begin, node->end, mid, node->max_y - node->min_y > node->max_x - node->min_x);
+        kd.nodes[2 * n + 1].begin = node->begin;
+        kd.nodes[2 * n + 1].end = mid;
+        kd.nodes[2 * n + 2].begin = mid;
+        kd.nodes[2 * n + 2].end = node->end;
+    }
+}
+
+static void kd_build(boids_world* world) {
+    kd.valid = false;
+    size_t count = world->count;
+    if(!count) {
+        return;
+    }
+    kd.depth = 0;
+    while(((count - 1) >> kd.depth) + 1 > BOIDS_KD_LEAF_SIZE) {
+        kd.depth++;
+    }
+    if(!kd_reserve(count, ((size_t)2 << kd.depth) - 1)) {
+        return;
+    }
+
+    boids_parallel_for(count, BOIDS_UPDATE_CHUNK, kd_points_fill, world);
+    kd.nodes[0].begin = 0;
+    kd.nodes[0].end = count;
+    for(size_t level = 0; level <= kd.depth; level++) {
+        //about BOIDS_UPDATE_CHUNK points per work item, the top levels have fewer nodes than threads
+        size_t points_per_node = (count >> level) + 1;
+        size_t chunk = points_per_node >= BOIDS_UPDATE_CHUNK ? 1 : BOIDS_UPDATE_CHUNK / points_per_node;
+        boids_parallel_for((size_t)1 << level, chunk, kd_split, &level);
+    }
+    kd.valid = true;
+}
+
+//lower bound of the wrapped distance from position to any point in the node
+static float kd_node_distance(const kd_node* node, hf_vec2f position) {
+    hf_vec2f offset;
+    wrap_offset(position[0] - (node->min_x + node->max_x) * .5f, position[1] - (node->min_y + node->max_y) * .5f, offset);
+    float dx = fmaxf(fabsf(offset[0]) - (node->max_x - node->min_x) * .5f, 0.f);
+    float dy = fmaxf(fabsf(offset[1]) - (node->max_y - node->min_y) * .5f, 0.f);
+    return dx * dx + dy * dy;
+}
+
+//the kd.k closest boids inside the largest radius, ties broken by index. Closer than the
+//radius of a smaller list, they are also the closest kd.k inside it.
+static void kd_get_neighbors(boids_world* world, size_t self, boid_neighbors* neighbors) {
+    hf_vec2f position = { world->x[self], world->y[self] };
+    float radius_sqr = 0.f;
+    for(size_t r = 0; r < boids_radius_count; r++) {
+        radius_sqr = fmaxf(radius_sqr, neighbors->radius_sqr[r]);
+    }
+
+    float nearest_dist_sqr[BOIDS_MAX_NEIGHBORS];
+    size_t nearest[BOIDS_MAX_NEIGHBORS];
+    size_t nearest_count = 0;
+    float limit = radius_sqr;
+    size_t nodes_count = ((size_t)2 << kd.depth) - 1;
+    size_t stack[64];
+    float stack_dist_sqr[64];//lower bound of each node, checked again when popped as the limit shrinks
+    size_t stack_count = 1;
+    stack[0] = 0;
+    stack_dist_sqr[0] = 0.f;
+    while(stack_count) {
+        stack_count--;
+        if(stack_dist_sqr[stack_count] > limit) {
+            continue;
+        }
+        const kd_node* node = &kd.nodes[stack[stack_count]];
+
+        size_t left = 2 * stack[stack_count] + 1;
+        if(left < nodes_count) {
+            //nearer child on top, so it is searched first and shrinks the limit for the other
+            float left_dist_sqr = kd_node_distance(&kd.nodes[left], position);
+            float right_dist_sqr = kd_node_distance(&kd.nodes[left + 1], position);
+            bool left_nearer = left_dist_sqr <= right_dist_sqr;
+            stack[stack_count] = left_nearer ? left + 1 : left;
+            stack_dist_sqr[stack_count++] = left_nearer ? right_dist_sqr : left_dist_sqr;
+            stack[stack_count] = left_nearer ? left : left + 1;
+            stack_dist_sqr[stack_count++] = left_nearer ? left_dist_sqr : right_dist_sqr;
+            continue;
+        }
+
+        neighbors->tests += node->end - node->begin;
+        for(size_t i = node->begin; i < node->end; i++) {
+            size_t index = kd.points[i].index;
+            hf_vec2f offset;
+            wrap_offset(position[0] - kd.points[i].x, position[1] - kd.points[i].y, offset);
+            float dist_sqr = offset[0] * offset[0] + offset[1] * offset[1];
+            if(index == self || !(dist_sqr < radius_sqr)) {
+                continue;
+            }
+            if(nearest_count == kd.k && (dist_sqr > nearest_dist_sqr[kd.k - 1] || (dist_sqr == nearest_dist_sqr[kd.k - 1] && index > nearest[kd.k - 1]))) {
+                continue;
+            }
+
+            size_t j = nearest_count < kd.k ? nearest_count++ : kd.k - 1;
+            while(j > 0 && (nearest_dist_sqr[j - 1] > dist_sqr || (nearest_dist_sqr[j - 1] == dist_sqr && nearest[j - 1] > index))) {
+                nearest_dist_sqr[j] = nearest_dist_sqr[j - 1];
+                nearest[j] = nearest[j - 1];
+                j--;
+            }
+            nearest_dist_sqr[j] = dist_sqr;
+            nearest[j] = index;
+            if(nearest_count == kd.k) {
+                limit = nearest_dist_sqr[kd.k - 1];
+            }
+        }
+    }
+
+    for(size_t r = 0; r < boids_radius_count; r++) {
+        for(size_t j = 0; j < nearest_count && nearest_dist_sqr[j] < neighbors->radius_sqr[r]; j++) {
+            neighbors->indices[r][neighbors->counts[r]++] = nearest[j];
+        }
+    }
+}
+
+void boids_world_compact(boids_world* world) {
+    if(!world->dead_count) {
+        return;
+    }
+    size_t count = 0;
+    for(size_t i = 0; i < world->count; i++) {
+        if(world->ids[i] == SIZE_MAX) {
+            continue;
+        }
+        world->x[count] = world->x[i];
+        world->y[count] = world->y[i];
+        world->vx[count] = world->vx[i];
+        world->vy[count] = world->vy[i];
+        world->ax[count] = world->ax[i];
+        world->ay[count] = world->ay[i];
+        world->species[count] = world->species[i];
+        world->ids[count] = world->ids[i];
+        world->slots[world->ids[count]] = count;
+        count++;
+    }
+    world->count = count;
+    world->dead_count = 0;
+
+    //lists hold slots, which just changed
+    verlet.valid = false;
+}
+
+//requests from other threads, pushed on a lock-free stack that the owner of the world swaps out
+//for an empty one in a single exchange, so producers never wait and no node is popped twice
+typedef struct boids_request_s {
+    struct boids_request_s* next;
+    boids_handle handle;//despawn target, id SIZE_MAX for a spawn
+    float x;
+    float y;
+    float vx;
+    float vy;
+    int species;
+} boids_request;
+
+static void request_push(boids_world* world, boids_request* request) {
+    void* head;
+    do {
+        head = SDL_AtomicGetPtr(&world->requests);
+        request->next = head;
+    } while(!SDL_AtomicCASPtr(&world->requests, head, request));
+}
+
+bool boids_world_request_spawn(boids_world* world, hf_vec2f position, hf_vec2f velocity, int species) {
+    boids_request* request = malloc(sizeof(boids_request));
+    if(!request) {
+        return false;
+    }
+    *request = (boids_request) {
+        .handle = { .id = SIZE_MAX },
+        .x = position[0],
+        .y = position[1],
+        .vx = velocity[0],
+        .vy = velocity[1],
+        .species = species,
+    };
+    request_push(world, request);
+    return true;
+}
+
+bool boids_world_request_despawn(boids_world* world, boids_handle handle) {
+    boids_request* request = malloc(sizeof(boids_request));
+    if(!request) {
+        return false;
+    }
+    *request = (boids_request) { .handle = handle };
+    request_push(world, request);
+    return true;
+}
+
+void boids_world_drain_requests(boids_world* world) {
+    boids_request* stack = SDL_AtomicSetPtr(&world->requests, NULL);
+
+    //the stack is newest first, reversed they apply in the order they were made
+    boids_request* queue = NULL;
+    while(stack) {
+        boids_request* next = stack->next;
+        stack->next = queue;
+        queue = stack;
+        stack = next;
+    }
+    while(queue) {
+        boids_request* next = queue->next;
+        if(queue->handle.id == SIZE_MAX) {
+            boids_world_spawn(world, (hf_vec2f) { queue->x, queue->y }, (hf_vec2f) { queue->vx, queue->vy }, queue->species);
+        }
+        else {
+            boids_world_despawn(world, queue->handle);
+        }
+        free(queue);
+        queue = next;
+    }
+}
+
+//Z-order sort of the world. Keys interleave 16 bits of each wrapped coordinate, sorted with a
+//stable least significant digit radix sort, then every array is gathered into the new order.
+static struct {
+    size_t period;
+    size_t steps;//updates since the last sort
+    uint32_t* keys;
+    uint32_t* keys_swap;
+    size_t* order;
+    size_t* order_swap;
+    size_t* scratch;
+    size_t capacity;
+} reorder;
+
+void boids_set_reorder_period(size_t period) {
+    reorder.period = period;
+    reorder.steps = 0;
+}
+
+static bool reorder_reserve(size_t count) {
+    if(count <= reorder.capacity) {
+        return true;
+    }
+    uint32_t* new_keys = realloc(reorder.keys, count * sizeof(uint32_t));
+    if(!new_keys) {
+        return false;
+    }
+    reorder.keys = new_keys;
+
+    uint32_t* new_keys_swap = realloc(reorder.keys_swap, count * sizeof(uint32_t));
+    if(!new_keys_swap) {
+        return false;
+    }
+    reorder.keys_swap = new_keys_swap;
+
+    size_t* new_order = realloc(reorder.order, count * sizeof(size_t));
+    if(!new_order) {
+        return false;
+    }
+    reorder.order = new_order;
+
+    size_t* new_order_swap = realloc(reorder.order_swap, count * sizeof(size_t));
+    if(!new_order_swap) {
+        return false;
+    }
+    reorder.order_swap = new_order_swap;
+
+    size_t* new_scratch = realloc(reorder.scratch, count * sizeof(size_t));
+    if(!new_scratch) {
+        return false;
+    }
+    reorder.scratch = new_scratch;
+    reorder.capacity = count;
+    return true;
+}
+
+//spreads the low 16 bits of value over the even bits
+static uint32_t morton_spread(uint32_t value) {
+    value &= 0xffff;
+    value = (value | (value << 8)) & 0x00ff00ff;
+    value = (value | (value << 4)) & 0x0f0f0f0f;
+    value = (value | (value << 2)) & 0x33333333;
+    value = (value | (value << 1)) & 0x55555555;
+    return value;
+}
+
+static void reorder_keys(size_t begin, size_t end, void* context) {
+    boids_world* world = context;
+    float cell_width = period.x / 65536.f;
+    float cell_height = period.y / 65536.f;
+    for(size_t i = begin; i < end; i++) {
+        uint32_t x = (uint32_t)grid_coord(world->x[i], bounds.min_x, cell_width, 65536);
+        uint32_t y = (uint32_t)grid_coord(world->y[i], bounds.min_y, cell_height, 65536);
+        reorder.keys[i] = morton_spread(x) | (morton_spread(y) << 1);
+        reorder.order[i] = i;
+    }
+}
+
+static void reorder_floats(float* array, size_t count) {
+    float* sorted = (float*)(void*)reorder.scratch;
+    for(size_t i = 0; i < count; i++) {
+        sorted[i] = array[reorder.order[i]];
+    }
+    memcpy(array, sorted, count * sizeof(float));
+}
+
+void boids_world_reorder(boids_world* world) {
+    boids_world_compact(world);
+    reorder.steps = 0;
+    size_t count = world->count;
+    if(count < 2 || period.x <= 0.f || period.y <= 0.f || !reorder_reserve(count)) {
+        return;
+    }
+    boids_parallel_for(count, BOIDS_UPDATE_CHUNK, reorder_keys, world);
+
+    for(uint32_t shift = 0; shift < 32; shift += 8) {
+        size_t offsets[257] = { 0 };
+        for(size_t i = 0; i < count; i++) {
+            offsets[((reorder.keys[i] >> shift) & 0xff) + 1]++;
+        }
+        if(offsets[((reorder.keys[0] >> shift) & 0xff) + 1] == count) {
+            continue;//every key has the same digit, the pass would not move anything
+        }
+        for(size_t d = 0; d < 256; d++) {
+            offsets[d + 1] += offsets[d];
+        }
+        for(size_t i = 0; i < count; i++) {
+            size_t slot = offsets[(reorder.keys[i] >> shift) & 0xff]++;
+            reorder.keys_swap[slot] = reorder.keys[i];
+            reorder.order_swap[slot] = reorder.order[i];
+        }
+        uint32_t* keys = reorder.keys;
+        reorder.keys = reorder.keys_swap;
+        reorder.keys_swap = keys;
+        size_t* order = reorder.order;
+        reorder.order = reorder.order_swap;
+        reorder.order_swap = order;
+    }
+
+    reorder_floats(world->x, count);
+    reorder_floats(world->y, count);
+    reorder_floats(world->vx, count);
+    reorder_floats(world->vy, count);
+    reorder_floats(world->ax, count);
+    reorder_floats(world->ay, count);
+
+    int* species = (int*)(void*)reorder.scratch;
+    for(size_t i = 0; i < count; i++) {
+        species[i] = world->species[reorder.order[i]];
+    }
+    memcpy(world->species, species, count * sizeof(int));
+
+    for(size_t i = 0; i < count; i++) {
+        reorder.scratch[i] = world->ids[reorder.order[i]];
+    }
+    memcpy(world->ids, reorder.scratch, count * sizeof(size_t));
+    for(size_t i = 0; i < count; i++) {
+        world->slots[world->ids[i]] = i;
+    }
+
+    //lists hold slots, which just changed
+    verlet.valid = false;
+}
+
+#define BOIDS_AGGREGATE_FIELDS 5//count, position x and y from the table origin, heading x and y
+
+//aggregate mode, see boids_set_aggregates. Each species has a summed-area table of its boids over
+//a grid finer than the search grid, so the cells a flock disk covers entirely are added up a
+//rectangle at a time and only the boids of the cells its edge cuts are tested one by one.
+static struct {
+    bool enabled;
+    float radius;
+    float cell_size;
+    float min_x;
+    float min_y;
+    float cell_width;
+    float cell_height;
+    int width;
+    int height;
+    size_t species_count;
+    double* table;//by species, (height + 1) * (width + 1) entries of the BOIDS_AGGREGATE_FIELDS sums of the cells above and left of it
+    size_t* cell_start;//boids of each cell in items, for the cells the disk edge cuts
+    size_t* items;
+    size_t table_capacity;
+    size_t cells_capacity;
+    size_t items_capacity;
+    bool valid;
+} aggregates;
+
+void boids_set_aggregates(bool enabled, float radius, float cell_size) {
+    aggregates.enabled = enabled && radius > 0.f && cell_size > 0.f;
+    aggregates.radius = radius;
+    aggregates.cell_size = cell_size;
+}
+
+static bool aggregates_reserve(size_t table_count, size_t cells_count, size_t items_count) {
+    if(table_count > aggregates.table_capacity) {
+        double* new_table = realloc(aggregates.table, table_count * sizeof(double));
+        if(!new_table) {
+            return false;
+        }
+        aggregates.table = new_table;
+        aggregates.table_capacity = table_count;
+    }
+    if(cells_count + 1 > aggregates.cells_capacity) {
+        size_t* new_memory = realloc(aggregates.cell_start, (cells_count + 1) * sizeof(size_t));
+        if(!new_memory) {
+            return false;
+        }
+        aggregates.cell_start = new_memory;
+        aggregates.cells_capacity = cells_count + 1;
+    }
+    if(items_count > aggregates.items_capacity) {
+        size_t* new_memory = realloc(aggregates.items, items_count * sizeof(size_t));
+        if(!new_memory) {
+            return false;
+        }
+        aggregates.items = new_memory;
+        aggregates.items_capacity = items_count;
+    }
+    return true;
+}
+
+//cell of value along one axis of the tables, out_coord gets its distance from min wrapped into
+//[0, size). Tables and queries both measure positions this way, so sums and cells always agree.
+static int aggregates_cell(float value, float min, float size, float cell_size, int cells, double* out_coord) {
+    double coord = fmod((double)value - (double)min, (double)size);
+    coord = coord < 0.0 ? coord + (double)size : coord;
+    if(!(coord >= 0.0 && coord < (double)size)) {//NaN, infinity or rounded up to size
+        coord = 0.0;
+    }
+    int cell = (int)(coord / (double)cell_size);
+    *out_coord = coord;
+    return cell < cells ? cell : cells - 1;
+}
+
+static double* aggregates_entry(size_t species, int row, int column) {
+    size_t entry = (species * (size_t)(aggregates.height + 1) + (size_t)row) * (size_t)(aggregates.width + 1) + (size_t)column;
+    return &aggregates.table[entry * BOIDS_AGGREGATE_FIELDS];
+}
+
+static void aggregates_build(boids_world* world) {
+    aggregates.valid = false;
+    if(!aggregates.enabled || kd.valid || grid.compact || period.x <= 0.f || period.y <= 0.f) {
+        return;
+    }
+    float width = floorf(period.x / aggregates.cell_size);
+    float height = floorf(period.y / aggregates.cell_size);
+    aggregates.min_x = bounds.min_x;
+    aggregates.min_y = bounds.min_y;
+    aggregates.width = width >= 1.f ? (int)width : 1;
+    aggregates.height = height >= 1.f ? (int)height : 1;
+    aggregates.cell_width = period.x / (float)aggregates.width;
+    aggregates.cell_height = period.y / (float)aggregates.height;
+    //a disk that reaches around the bounds would count boids twice
+    if(2.f * aggregates.radius + aggregates.cell_width >= period.x || 2.f * aggregates.radius + aggregates.cell_height >= period.y) {
+        return;
+    }
+    aggregates.species_count = 1;
+    for(size_t i = 0; i < world->count; i++) {
+        size_t species = species_index(world->species[i]);
+        aggregates.species_count = species >= aggregates.species_count ? species + 1 : aggregates.species_count;
+    }
+
+    size_t cells_count = (size_t)aggregates.width * (size_t)aggregates.height;
+    size_t table_count = (size_t)(aggregates.width + 1) * (size_t)(aggregates.height + 1) * aggregates.species_count * BOIDS_AGGREGATE_FIELDS;
+    if(!aggregates_reserve(table_count, cells_count, world->count)) {
+        return;
+    }
+
+    for(size_t k = 0; k < table_count; k++) {
+        aggregates.table[k] = 0.0;
+    }
+    for(size_t c = 0; c <= cells_count; c++) {
+        aggregates.cell_start[c] = 0;
+    }
+    for(size_t i = 0; i < world->count; i++) {
+        double x;
+        double y;
+        int column = aggregates_cell(world->x[i], aggregates.min_x, period.x, aggregates.cell_width, aggregates.width, &x);
+        int row = aggregates_cell(world->y[i], aggregates.min_y, period.y, aggregates.cell_height, aggregates.height, &y);
+        aggregates.cell_start[(size_t)row * (size_t)aggregates.width + (size_t)column + 1]++;
+
+        hf_vec2f heading;
+        hf_vec2f_normalize((hf_vec2f) { world->vx[i], world->vy[i] }, heading);
+        double* sums = aggregates_entry(species_index(world->species[i]), row + 1, column + 1);
+        sums[0] += 1.0;
+        sums[1] += x;
+        sums[2] += y;
+        sums[3] += (double)heading[0];
+        sums[4] += (double)heading[1];
+    }
+
+    for(size_t c = 0; c < cells_count; c++) {
+        aggregates.cell_start[c + 1] += aggregates.cell_start[c];
+    }
+    for(size_t i = 0; i < world->count; i++) {
+        double x;
+        double y;
+        int column = aggregates_cell(world->x[i], aggregates.min_x, period.x, aggregates.cell_width, aggregates.width, &x);
+        int row = aggregates_cell(world->y[i], aggregates.min_y, period.y, aggregates.cell_height, aggregates.height, &y);
+        aggregates.items[aggregates.cell_start[(size_t)row * (size_t)aggregates.width + (size_t)column]++] = i;
+    }
+    for(size_t c = cells_count; c > 0; c--) {
+        aggregates.cell_start[c] = aggregates.cell_start[c - 1];
+    }
+    aggregates.cell_start[0] = 0;
+
+    for(size_t s = 0; s < aggregates.species_count; s++) {
+        for(int row = 1; row <= aggregates.height; row++) {
+            for(int column = 1; column <= aggregates.width; column++) {
+                double* entry = aggregates_entry(s, row, column);
+                const double* up = aggregates_entry(s, row - 1, column);
+                const double* left = entry - BOIDS_AGGREGATE_FIELDS;
+                const double* up_left = up - BOIDS_AGGREGATE_FIELDS;
+                for(size_t f = 0; f < BOIDS_AGGREGATE_FIELDS; f++) {
+                    entry[f] += up[f] + left[f] - up_left[f];
+                }
+            }
+        }
+    }
+    aggregates.valid = true;
+}
+
+//flock sums of one query by species, positions relative to self
+typedef struct aggregates_query_s {
+    double sums[BOIDS_MAX_SPECIES][BOIDS_AGGREGATE_FIELDS];
+    const unsigned int* species_radii;//of self, species without the flock bit are left out
+    double x;//self in table coordinates
+    double y;
+} aggregates_query;
+
+//adds the cells of a rectangle of unwrapped rows and columns no larger than the tables,
+//split where it wraps around
+static void aggregates_add_rect(aggregates_query* query, int row_begin, int row_end, int column_begin, int column_end) {
+    for(int row = row_begin; row <= row_end;) {
+        int row_shift = row < 0 ? -1 : (row >= aggregates.height ? 1 : 0);
+        int wrapped_row = row - row_shift * aggregates.height;
+        int rows = row_end - row + 1 < aggregates.height - wrapped_row ? row_end - row + 1 : aggregates.height - wrapped_row;
+        for(int column = column_begin; column <= column_end;) {
+            int column_shift = column < 0 ? -1 : (column >= aggregates.width ? 1 : 0);
+            int wrapped_column = column - column_shift * aggregates.width;
+            int columns = column_end - column + 1 < aggregates.width - wrapped_column ? column_end - column + 1 : aggregates.width - wrapped_column;
+
+            //positions of the boids in there are table coordinates plus the shift of the copy they are seen in
+            double offset_x = (double)column_shift * (double)period.x - query->x;
+            double offset_y = (double)row_shift * (double)period.y - query->y;
+            for(size_t s = 0; s < aggregates.species_count; s++) {
+                if(!(query->species_radii[s] & (1u << boids_radius_flock))) {
+                    continue;
+                }
+                const double* a = aggregates_entry(s, wrapped_row, wrapped_column);
+                const double* b = aggregates_entry(s, wrapped_row, wrapped_column + columns);
+                const double* c = aggregates_entry(s, wrapped_row + rows, wrapped_column);
+                const double* d = aggregates_entry(s, wrapped_row + rows, wrapped_column + columns);
+                double count = d[0] - b[0] - c[0] + a[0];
+                query->sums[s][0] += count;
+                query->sums[s][1] += d[1] - b[1] - c[1] + a[1] + count * offset_x;
+                query->sums[s][2] += d[2] - b[2] - c[2] + a[2] + count * offset_y;
+                query->sums[s][3] += d[3] - b[3] - c[3] + a[3];
+                query->sums[s][4] += d[4] - b[4] - c[4] + a[4];
+            }
+            column += columns;
+        }
+        row += rows;
+    }
+}
+
+static void aggregates_test_cell(boids_world* world, size_t self, aggregates_query* query, float radius_sqr, int row, int column, size_t* tests) {
+    row = row < 0 ? row + aggregates.height : (row >= aggregates.height ? row - aggregates.height : row);
+    column = column < 0 ? column + aggregates.width : (column >= aggregates.width ? column - aggregates.width : column);
+    size_t cell = (size_t)row * (size_t)aggregates.width + (size_t)column;
+    for(size_t k = aggregates.cell_start[cell]; k < aggregates.cell_start[cell + 1]; k++) {
+        size_t other = aggregates.items[k];
+        size_t species = species_index(world->species[other]);
+        if(other == self || !(query->species_radii[species] & (1u << boids_radius_flock))) {
+            continue;
+        }
+        (*tests)++;
+        hf_vec2f offset;
+        wrap_offset(world->x[other] - world->x[self], world->y[other] - world->y[self], offset);
+        if(offset[0] * offset[0] + offset[1] * offset[1] >= radius_sqr) {
+            continue;
+        }
+        hf_vec2f heading;
+        hf_vec2f_normalize((hf_vec2f) { world->vx[other], world->vy[other] }, heading);
+        query->sums[species][0] += 1.0;
+        query->sums[species][1] += (double)offset[0];
+        query->sums[species][2] += (double)offset[1];
+        query->sums[species][3] += (double)heading[0];
+        query->sums[species][4] += (double)heading[1];
+    }
+}
+
+//squared distances from 0 to the nearest and farthest points of [begin, begin + size]
+static void aggregates_span_distances(double begin, double size, double* out_near, double* out_far) {
+    double end = begin + size;
+    double near = begin > 0.0 ? begin : (end < 0.0 ? end : 0.0);
+    double far = fabs(begin) > fabs(end) ? begin : end;
+    *out_near = near * near;
+    *out_far = far * far;
+}
+
+//fills the flock sums of neighbors from the tables. Cells the disk covers entirely come from them,
+//merged into rectangles over consecutive rows whose covered columns match.
+static void aggregates_get_flock(boids_world* world, size_t self, boid_neighbors* neighbors) {
+    double radius = (double)aggregates.radius;
+    double radius_sqr = radius * radius;
+    double cell_width = (double)aggregates.cell_width;
+    double cell_height = (double)aggregates.cell_height;
+    aggregates_query query;
+    query.species_radii = interactions.radii[species_index(world->species[self])];
+    int self_column = aggregates_cell(world->x[self], aggregates.min_x, period.x, aggregates.cell_width, aggregates.width, &query.x);
+    int self_row = aggregates_cell(world->y[self], aggregates.min_y, period.y, aggregates.cell_height, aggregates.height, &query.y);
+    for(size_t s = 0; s < aggregates.species_count; s++) {
+        for(size_t f = 0; f < BOIDS_AGGREGATE_FIELDS; f++) {
+            query.sums[s][f] = 0.0;
+        }
+    }
+
+    int row_begin = (int)floor((query.y - radius) / cell_height);
+    int row_end = (int)floor((query.y + radius) / cell_height);
+    int column_begin = (int)floor((query.x - radius) / cell_width);
+    int column_end = (int)floor((query.x + radius) / cell_width);
+    bool self_covered = false;
+    int rect_row_begin = 0;
+    int rect_row_end = -1;
+    int rect_column_begin = 0;
+    int rect_column_end = -1;
+    for(int row = row_begin; row <= row_end; row++) {
+        double near_y;
+        double far_y;
+        aggregates_span_distances((double)row * cell_height - query.y, cell_height, &near_y, &far_y);
+        int covered_begin = 0;
+        int covered_end = -1;
+        for(int column = column_begin; column <= column_end; column++) {
+            double near_x;
+            double far_x;
+            aggregates_span_distances((double)column * cell_width - query.x, cell_width, &near_x, &far_x);
+            if(near_x + near_y >= radius_sqr) {
+                continue;
+            }
+            if(far_x + far_y < radius_sqr) {
+                covered_begin = covered_end < covered_begin ? column : covered_begin;
+                covered_end = column;
+                self_covered |= row == self_row && column == self_column;
+                continue;
+            }
+            aggregates_test_cell(world, self, &query, (float)radius_sqr, row, column, &neighbors->tests);
+        }
+
+        if(covered_end < covered_begin) {
+            continue;
+        }
+        if(row == rect_row_end + 1 && covered_begin == rect_column_begin && covered_end == rect_column_end) {
+            rect_row_end = row;
+            continue;
+        }
+        if(rect_row_end >= rect_row_begin) {
+            aggregates_add_rect(&query, rect_row_begin, rect_row_end, rect_column_begin, rect_column_end);
+        }
+        rect_row_begin = row;
+        rect_row_end = row;
+        rect_column_begin = covered_begin;
+        rect_column_end = covered_end;
+    }
+    if(rect_row_end >= rect_row_begin) {
+        aggregates_add_rect(&query, rect_row_begin, rect_row_end, rect_column_begin, rect_column_end);
+    }
+
+    //self is in the tables too, at offset 0
+    size_t species = species_index(world->species[self]);
+    if(self_covered && (query.species_radii[species] & (1u << boids_radius_flock))) {
+        hf_vec2f heading;
+        hf_vec2f_normalize((hf_vec2f) { world->vx[self], world->vy[self] }, heading);
+        query.sums[species][0] -= 1.0;
+        query.sums[species][3] -= (double)heading[0];
+        query.sums[species][4] -= (double)heading[1];
+    }
+
+    neighbors->aggregated = true;
+    neighbors->aggregate_species = aggregates.species_count;
+    for(size_t s = 0; s < aggregates.species_count; s++) {
+        neighbors->aggregate_counts[s] = (size_t)(query.sums[s][0] + .5);
+        neighbors->aggregate_toward[s][0] = (float)query.sums[s][1];
+        neighbors->aggregate_toward[s][1] = (float)query.sums[s][2];
+        neighbors->aggregate_heading[s][0] = (float)query.sums[s][3];
+        neighbors->aggregate_heading[s][1] = (float)query.sums[s][4];
+    }
+}
+
+//batch_skin > 0 builds neighbor lists of that skin for a boids_world_update_steps batch in place
+//of the grid queries, which find the same neighbors. Unlike lists the user set, they keep the
+//reorder schedule of single updates.
+static void neighbors_prepare(boids_world* world, float batch_skin) {
+    bool reorder_due = reorder.period && ++reorder.steps >= reorder.period;
+    grid.compact = false;
+    if(kd.enabled) {
+        verlet.valid = false;
+        if(reorder_due) {
+            boids_world_reorder(world);
+        }
+        kd_build(world);
+        return;
+    }
+    kd.valid = false;
+
+    if(!verlet.enabled && !(batch_skin > 0.f)) {
+        verlet.valid = false;
+        if(reorder_due) {
+            boids_world_reorder(world);
+        }
+        grid_build(world, BOIDS_MAX_RADIUS, compact_enabled, species_partition);
+        predators_build(world);
+        return;
+    }
+
+    float skin = verlet.enabled ? verlet.skin : batch_skin;
+    if(reorder_due && !verlet.enabled) {
+        boids_world_reorder(world);//drops the lists
+    }
+    if(verlet_needs_build(world, skin)) {
+        if(reorder_due && verlet.enabled) {
+            boids_world_reorder(world);
+        }
+        grid_build(world, BOIDS_MAX_RADIUS + skin, false, false);
+        predators_build(world);
+        verlet_build(world, skin);
+    }
+    else if(verlet.overflow_count) {
+        //boids without a list still go through the grid, which has to be current
+        grid_build(world, BOIDS_MAX_RADIUS + skin, false, false);
+        predators_build(world);
+    }
+}
+
+//fills the lists in radii, the others get radius 0 and stay empty
+static void boid_get_neighbors(boids_world* world, size_t self, unsigned int radii, boid_neighbors* neighbors) {
+    bool hunter = interactions.any[boids_interaction_hunt][species_index(world->species[self])];
+#define RADIUS_SET(name, radius, hunting_radius) neighbors->radius_sqr[boids_radius_##name] = hunter ? hunting_radius * hunting_radius : radius * radius;
+    BOIDS_RADII(RADIUS_SET)
+#undef RADIUS_SET
+    for(size_t r = 0; r < boids_radius_count; r++) {
+        neighbors->radius_sqr[r] = radii & (1u << r) ? neighbors->radius_sqr[r] : 0.f;
+        neighbors->counts[r] = 0;
+    }
+    neighbors->tests = 0;
+    neighbors->radii = radii;
+    neighbors->aggregated = false;
+
+    if(kd.valid) {
+        kd_get_neighbors(world, self, neighbors);
+        return;
+    }
+
+    if(aggregates.valid) {
+        if(radii & (1u << boids_radius_flock)) {
+            aggregates_get_flock(world, self, neighbors);
+        }
+        radii &= ~(1u << boids_radius_flock);
+        neighbors->radii = radii;
+        neighbors->radius_sqr[boids_radius_flock] = 0.f;
+    }
+
+    hf_vec2f position = { world->x[self], world->y[self] };
+    if(verlet.valid && !verlet.overflow[self]) {
+        const size_t* items = &verlet.items[verlet.start[self]];
+        size_t count = verlet.start[self + 1] - verlet.start[self];
+        //boids that do not hunt only target predators, as through the grid
+        bool targets = predators.valid && !hunter && (radii & (1u << boids_radius_target));
+        float target_radius_sqr = neighbors->radius_sqr[boids_radius_target];
+        if(targets) {
+            verlet_get_targets(world, self, position, items, count, neighbors);
+            neighbors->radii = radii & ~(1u << boids_radius_target);
+            neighbors->radius_sqr[boids_radius_target] = 0.f;
+        }
+        neighbors_test_list(neighbors, position, world, items, count);
+        neighbors->radii = radii;
+        neighbors->radius_sqr[boids_radius_target] = target_radius_sqr;
+        return;
+    }
+    if(grid.valid) {
+        grid_get_neighbors(world, self, neighbors);
+        return;
+    }
+    for(size_t i = 0; i < world->count && !neighbors_full_radii(neighbors, radii); i++) {
+        if(i != self) {
+            neighbors_test(neighbors, neighbors->radius_sqr, position, world, i);
+            neighbors->tests++;
+        }
+    }
+}
+
+typedef enum rule_kernel_e {
+    rule_kernel_away,
+    rule_kernel_heading,
+    rule_kernel_toward,
+} rule_kernel;
+
+//steering rules, X(name, list, interaction, kernel, intensity). Each one averages kernel over the
+//boids of its neighbor list, each scaled by its weight in the interaction row of self, and adds the
+//average times intensity to the acceleration, in table order. Rules of a species whose row has no
+//weight are skipped. Rules sharing a list are summed in the same pass over it.
+#define BOIDS_RULES(X)\
+    X(separation, separation, separation, away, 4.f)\
+    X(alignment, flock, flock, heading, .8f)\
+    X(cohesion, flock, flock, toward, .5f)\
+    X(hunt, target, hunt, toward, 5.f)\
+    X(flee, target, flee, away, 5.f)
+
+#define RULE_ENUM(name, list, interaction, kernel, intensity) rule_##name,
+enum {
+    BOIDS_RULES(RULE_ENUM)
+    rules_count,
+};
+#undef RULE_ENUM
+
+typedef struct rule_sums_s {
+    const float* weights[rules_count];//interaction row of self, NULL when it has no weight
+    hf_vec2f sums[rules_count];
+    size_t counts[rules_count];
+} rule_sums;
+
+//normalized direction from the neighbor to self
+static void kernel_away(boids_world* world, size_t self, size_t other, hf_vec2f out) {
+    wrap_offset(world->x[self] - world->x[other], world->y[self] - world->y[other], out);
+    hf_vec2f_normalize(out, out);
+}
+
+//normalized neighbor velocity, a rule with no neighbors keeps the heading of self
+static void kernel_heading(boids_world* world, size_t self, size_t other, hf_vec2f out) {
+    (void)self;
+    hf_vec2f_normalize((hf_vec2f) { world->vx[other], world->vy[other] }, out);
+}
+
+//wrapped offset from self to the neighbor
+static void kernel_toward(boids_world* world, size_t self, size_t other, hf_vec2f out) {
+    wrap_offset(world->x[other] - world->x[self], world->y[other] - world->y[self], out);
+}
+
+#ifdef BOIDS_SIMD_WIDTH
+static void simd_normalize(simd_float* x, simd_float* y) {
+    simd_float magnitude = simd_sqrt(simd_add(simd_mul(*x, *x), simd_mul(*y, *y)));
+    *x = simd_div(*x, magnitude);
+    *y = simd_div(*y, magnitude);
+}
+
+static void kernel_away_simd(boids_world* world, const size_t* batch, simd_float px, simd_float py, simd_float* out_x, simd_float* out_y) {
+    *out_x = simd_wrap(simd_sub(px, simd_gather(world->x, batch)), period.x, period.inv_x);
+    *out_y = simd_wrap(simd_sub(py, simd_gather(world->y, batch)), period.y, period.inv_y);
+    simd_normalize(out_x, out_y);
+}
+
+static void kernel_heading_simd(boids_world* world, const size_t* batch, simd_float px, simd_float py, simd_float* out_x, simd_float* out_y) {
+    (void)px;
+    (void)py;
+    *out_x = simd_gather(world->vx, batch);
+    *out_y = simd_gather(world->vy, batch);
+    simd_normalize(out_x, out_y);
+}
+
+static void kernel_toward_simd(boids_world* world, const size_t* batch, simd_float px, simd_float py, simd_float* out_x, simd_float* out_y) {
+    *out_x = simd_wrap(simd_sub(simd_gather(world->x, batch), px), period.x, period.inv_x);
+    *out_y = simd_wrap(simd_sub(simd_gather(world->y, batch), py), period.y, period.inv_y);
+}
+
+static void simd_reduce(simd_float x, simd_float y, hf_vec2f out_sum) {
+    float lanes_x[BOIDS_SIMD_WIDTH];
+    float lanes_y[BOIDS_SIMD_WIDTH];
+    simd_storeu(lanes_x, x);
+    simd_storeu(lanes_y, y);
+    for(size_t l = 0; l < BOIDS_SIMD_WIDTH; l++) {
+        out_sum[0] += lanes_x[l];
+        out_sum[1] += lanes_y[l];
+    }
+}
+
+#define RULE_SUM_SIMD(name, list, interaction, kernel, intensity)\
+    if(boids_radius_##list == list_index && sums->weights[rule_##name]) {\
+        simd_float weight = simd_gather(sums->weights[rule_##name], lane_species);\
+        simd_float mask = simd_andnot(simd_equal(weight, simd_set1(0.f)), lanes_mask);\
+        simd_float vx;\
+        simd_float vy;\
+        kernel_##kernel##_simd(world, batch, px, py, &vx, &vy);\
+        sum_x[rule_##name] = simd_add(sum_x[rule_##name], simd_and(simd_mul(vx, weight), mask));\
+        sum_y[rule_##name] = simd_add(sum_y[rule_##name], simd_and(simd_mul(vy, weight), mask));\
+        for(int bits = simd_mask(mask); bits; bits &= bits - 1) {\
+            sums->counts[rule_##name]++;\
+        }\
+    }
+
+#define RULE_REDUCE_SIMD(name, list, interaction, kernel, intensity)\
+    if(boids_radius_##list == list_index) {\
+        simd_reduce(sum_x[rule_##name], sum_y[rule_##name], sums->sums[rule_##name]);\
+    }
+
+//SIMD counterpart of the loop of rules_sum_<list>, which stays as the reference and also handles
+//lists shorter than one batch. Lanes outside the list or with no weight are masked to zero.
+#define RULES_SUM_LIST_SIMD(list, radius, hunting_radius)\
+static void rules_sum_##list##_simd(boids_world* world, size_t self, const size_t* indices, size_t count, rule_sums* sums) {\
+    static const float lane_index[8] = { 0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f };\
+    const size_t list_index = boids_radius_##list;\
+    simd_float px = simd_set1(world->x[self]);\
+    simd_float py = simd_set1(world->y[self]);\
+    simd_float sum_x[rules_count];\
+    simd_float sum_y[rules_count];\
+    for(size_t r = 0; r < rules_count; r++) {\
+        sum_x[r] = simd_set1(0.f);\
+        sum_y[r] = simd_set1(0.f);\
+    }\
+    for(size_t i = 0; i < count; i += BOIDS_SIMD_WIDTH) {\
+        size_t batch[BOIDS_SIMD_WIDTH];\
+        size_t lanes = simd_batch(&indices[i], count - i, batch);\
+        simd_float lanes_mask = simd_less(simd_loadu(lane_index), simd_set1((float)lanes));\
+        size_t lane_species[BOIDS_SIMD_WIDTH];\
+        for(size_t l = 0; l < BOIDS_SIMD_WIDTH; l++) {\
+            lane_species[l] = species_index(world->species[batch[l]]);\
+        }\
+        BOIDS_RULES(RULE_SUM_SIMD)\
+    }\
+    BOIDS_RULES(RULE_REDUCE_SIMD)\
+}
+
+BOIDS_RADII(RULES_SUM_LIST_SIMD)
+#undef RULES_SUM_LIST_SIMD
+#undef RULE_REDUCE_SIMD
+#undef RULE_SUM_SIMD
+
+#define RULES_SUM_SIMD_CALL(list)\
+    if(simd_enabled && count >= BOIDS_SIMD_WIDTH) {\
+        rules_sum_##list##_simd(world, self, indices, count, sums);\
+        return;\
+    }
+#else
+#define RULES_SUM_SIMD_CALL(list)
+#endif
+
+#define RULE_SUM(name, list, interaction, kernel, intensity)\
+    if(boids_radius_##list == list_index && sums->weights[rule_##name] && sums->weights[rule_##name][species] != 0.f) {\
+        hf_vec2f value;\
+        kernel_##kernel(world, self, other, value);\
+        hf_vec2f_multiply(value, sums->weights[rule_##name][species], value);\
+        hf_vec2f_add(sums->sums[rule_##name], value, sums->sums[rule_##name]);\
+        sums->counts[rule_##name]++;\
+    }
+
+//aggregate mode sums of the flock list, toward from the offset sums and heading from the heading
+//sums. No rule of the flock list can use away, its normalized offsets have no per cell sums.
+static void rule_sum_aggregated(boid_neighbors* neighbors, const float* weights, rule_kernel kernel, hf_vec2f sum, size_t* count) {
+    for(size_t s = 0; s < neighbors->aggregate_species; s++) {
+        if(weights[s] == 0.f || !neighbors->aggregate_counts[s]) {
+            continue;
+        }
+        hf_vec2f value;
+        hf_vec2f_multiply(kernel == rule_kernel_heading ? neighbors->aggregate_heading[s] : neighbors->aggregate_toward[s], weights[s], value);
+        hf_vec2f_add(sum, value, sum);
+        *count += neighbors->aggregate_counts[s];
+    }
+}
+
+#define RULE_SUM_AGGREGATED(name, list, interaction, kernel, intensity)\
+    if(boids_radius_##list == boids_radius_flock && sums->weights[rule_##name]) {\
+        rule_sum_aggregated(neighbors, sums->weights[rule_##name], rule_kernel_##kernel, sums->sums[rule_##name], &sums->counts[rule_##name]);\
+    }
+
+//rules_sum_<list>, one pass over a neighbor list for every rule of that list. Each list gets its own
+//instance, so its loop only holds its own rules and calls no kernel through a pointer.
+#define RULES_SUM_LIST(list, radius, hunting_radius)\
+static void rules_sum_##list(boids_world* world, size_t self, boid_neighbors* neighbors, rule_sums* sums) {\
+    const size_t list_index = boids_radius_##list;\
+    if(list_index == boids_radius_flock && neighbors->aggregated) {\
+        BOIDS_RULES(RULE_SUM_AGGREGATED)\
+        return;\
+    }\
+    const size_t* indices = neighbors->indices[list_index];\
+    size_t count = neighbors->counts[list_index];\
+    RULES_SUM_SIMD_CALL(list)\
+    for(size_t i = 0; i < count; i++) {\
+        size_t other = indices[i];\
+        size_t species = species_index(world->species[other]);\
+        BOIDS_RULES(RULE_SUM)\
+    }\
+}
+
+BOIDS_RADII(RULES_SUM_LIST)
+#undef RULES_SUM_LIST
+#undef RULE_SUM_AGGREGATED
+#undef RULE_SUM
+#undef RULES_SUM_SIMD_CALL
+
+//contribution of a rule to the acceleration, false when it has none
+static bool rule_apply(boids_world* world, size_t self, rule_sums* sums, size_t rule, rule_kernel kernel, float intensity, hf_vec2f out) {
+    if(!sums->weights[rule] && kernel != rule_kernel_heading) {
+        return false;
+    }
+    hf_vec2f res = { sums->sums[rule][0], sums->sums[rule][1] };
+    if(sums->counts[rule]) {
+        hf_vec2f_divide(res, (float)sums->counts[rule], res);
+    }
+    else if(kernel == rule_kernel_heading) {
+        hf_vec2f_normalize((hf_vec2f) { world->vx[self], world->vy[self] }, res);
+    }
+    hf_vec2f_multiply(res, intensity, out);
+    return true;
+}
+
+#define RULES_ALL ((1u << rules_count) - 1)
+
+//the neighbor lists the rules in a mask of rules read
+static unsigned int rules_radii(unsigned int rules) {
+    unsigned int radii = 0;
+#define RULE_RADIUS(name, list, interaction, kernel, intensity) radii |= rules & (1u << rule_##name) ? 1u << boids_radius_##list : 0;
+    BOIDS_RULES(RULE_RADIUS)
+#undef RULE_RADIUS
+    return radii;
+}
+
+//contributions of each rule to the acceleration of a boid, see boids_set_rule_period
+typedef struct rule_cache_entry_s {
+    hf_vec2f contributions[rules_count];
+    unsigned int ages[rules_count];//turns since the rule was evaluated
+    uint32_t generation;//of the boid the entry was filled for
+    bool filled;
+} rule_cache_entry;
+
+//rule periods and the cached contributions by boid id, ids stay with their boid through reorders
+//and compaction. Like neighbor lists, the cache follows whichever world was updated last.
+static struct {
+    size_t periods[boids_rule_count];
+    bool enabled;//some period above 1
+    bool valid;//entries cover the ids of the world being updated
+    rule_cache_entry* entries;
+    size_t capacity;
+} rule_cache;
+
+void boids_set_rule_period(boids_rule rule, size_t period) {
+    if((unsigned int)rule >= boids_rule_count) {
+        return;
+    }
+    rule_cache.periods[rule] = period;
+    rule_cache.enabled = false;
+    for(size_t r = 0; r < boids_rule_count; r++) {
+        rule_cache.enabled |= rule_cache.periods[r] > 1;
+    }
+}
+
+//entries are dropped when another world, or one initialized again with the same ids, comes along
+static void rule_cache_prepare(boids_world* world) {
+    rule_cache.valid = false;
+    if(!rule_cache.enabled) {
+        rule_cache_world = NULL;
+        return;
+    }
+    if(world->ids_count > rule_cache.capacity) {
+        size_t capacity = rule_cache.capacity ? rule_cache.capacity : 64;
+        while(capacity < world->ids_count) {
+            capacity *= 2;
+        }
+        rule_cache_entry* new_entries = realloc(rule_cache.entries, capacity * sizeof(rule_cache_entry));
+        if(!new_entries) {
+            return;
+        }
+        memset(new_entries + rule_cache.capacity, 0, (capacity - rule_cache.capacity) * sizeof(rule_cache_entry));
+        rule_cache.entries = new_entries;
+        rule_cache.capacity = capacity;
+    }
+    if(rule_cache_world != world->memory && rule_cache.entries) {
+        memset(rule_cache.entries, 0, rule_cache.capacity * sizeof(rule_cache_entry));
+    }
+    rule_cache_world = world->memory;
+    rule_cache.valid = true;
+}
+
+//rules boid i evaluates this turn, out_entry gets its cache entry or NULL when caching is off. A new
+//entry evaluates every rule, then starts each one at an age set by the id, so boids spread their
+//evaluations over the period instead of all taking the same turns.
+static unsigned int rule_cache_due(boids_world* world, size_t i, rule_cache_entry** out_entry) {
+    *out_entry = NULL;
+    if(!rule_cache.valid) {
+        return RULES_ALL;
+    }
+    size_t id = world->ids[i];
+    rule_cache_entry* entry = &rule_cache.entries[id];
+    *out_entry = entry;
+    unsigned int rules = 0;
+    bool fill = !entry->filled || entry->generation != world->generations[id];
+#define RULE_DUE(name, list, interaction, kernel, intensity)\
+    {\
+        size_t period = rule_cache.periods[boids_rule_##name];\
+        if(fill) {\
+            entry->ages[rule_##name] = period > 1 ? (unsigned int)(id % period) : 0;\
+            rules |= 1u << rule_##name;\
+        }\
+        else if(period <= 1 || ++entry->ages[rule_##name] >= period) {\
+            entry->ages[rule_##name] = 0;\
+            rules |= 1u << rule_##name;\
+        }\
+    }
+    BOIDS_RULES(RULE_DUE)
+#undef RULE_DUE
+    entry->filled = true;
+    entry->generation = world->generations[id];
+    return rules;
+}
+
+//box of a polygon or of a bvh node
+typedef struct obstacle_box_s {
+    float min_x;
+    float min_y;
+    float max_x;
+    float max_y;
+} obstacle_box;
+
+//flat bounding volume hierarchy, node 0 is the root and the children of an inner node are adjacent
+typedef struct bvh_node_s {
+    obstacle_box box;
+    uint32_t first;//first polygon in order of a leaf, first child of an inner node
+    uint32_t count;//polygons of a leaf, 0 for inner nodes
+} bvh_node;
+
+//static convex polygons the boids of a world steer around, see boids_world_set_obstacles. Candidate
+//polygons are kept for each cell of a grid over the bounds, so a boid only tests the few near its
+//cell and the hierarchy is only walked once per cell, again whenever the bounds change.
+typedef struct obstacle_set_s {
+    hf_vec2f* points;
+    size_t* starts;//points of polygon i are [starts[i], starts[i + 1])
+    obstacle_box* boxes;
+    uint32_t* order;//polygons sorted by leaf
+    size_t count;
+    bvh_node* nodes;
+    size_t nodes_count;
+
+    float min_x;
+    float min_y;
+    float cell_width;
+    float cell_height;
+    int width;
+    int height;
+    size_t* cell_start;
+    uint32_t* cell_items;
+    size_t cell_items_count;
+    size_t cell_items_capacity;
+    bool cells_valid;
+} obstacle_set;
+
+static void obstacles_free(obstacle_set* obstacles) {
+    if(!obstacles) {
+        return;
+    }
+    free(obstacles->points);
+    free(obstacles->starts);
+    free(obstacles->boxes);
+    free(obstacles->order);
+    free(obstacles->nodes);
+    free(obstacles->cell_start);
+    free(obstacles->cell_items);
+    free(obstacles);
+}
+
+static void obstacle_box_grow(obstacle_box* box, const obstacle_box* other) {
+    box->min_x = fminf(box->min_x, other->min_x);
+    box->min_y = fminf(box->min_y, other->min_y);
+    box->max_x = fmaxf(box->max_x, other->max_x);
+    box->max_y = fmaxf(box->max_y, other->max_y);
+}
+
+//half perimeter, which stands in for the surface area of the heuristic in 2d
+static float obstacle_box_cost(const obstacle_box* box) {
+    return (box->max_x - box->min_x) + (box->max_y - box->min_y);
+}
+
+static float obstacle_center(const obstacle_set* obstacles, size_t polygon, bool axis_y) {
+    const obstacle_box* box = &obstacles->boxes[polygon];
+    return axis_y ? (box->min_y + box->max_y) * .5f : (box->min_x + box->max_x) * .5f;
+}
+
+//splits the polygons of a node along the wider axis of their centers at the best of
+//BOIDS_BVH_BINS bins by the surface area heuristic, or keeps them as a leaf when no split is cheaper
+static void bvh_build(obstacle_set* obstacles, size_t node, size_t begin, size_t end, size_t depth) {
+    bvh_node* n = &obstacles->nodes[node];
+    n->box = obstacles->boxes[obstacles->order[begin]];
+    float center_min[2] = { INFINITY, INFINITY };
+    float center_max[2] = { -INFINITY, -INFINITY };
+    for(size_t i = begin; i < end; i++) {
+        obstacle_box_grow(&n->box, &obstacles->boxes[obstacles->order[i]]);
+        for(size_t axis = 0; axis < 2; axis++) {
+            float center = obstacle_center(obstacles, obstacles->order[i], axis);
+            center_min[axis] = fminf(center_min[axis], center);
+            center_max[axis] = fmaxf(center_max[axis], center);
+        }
+    }
+    n->first = (uint32_t)begin;
+    n->count = (uint32_t)(end - begin);
+    bool axis_y = center_max[1] - center_min[1] > center_max[0] - center_min[0];
+    float extent = center_max[axis_y] - center_min[axis_y];
+    if(end - begin <= BOIDS_BVH_LEAF_SIZE || depth >= BOIDS_BVH_MAX_DEPTH || !(extent > 0.f)) {
+        return;
+    }
+
+    size_t bin_counts[BOIDS_BVH_BINS] = { 0 };
+    obstacle_box bin_boxes[BOIDS_BVH_BINS];
+    float scale = (float)BOIDS_BVH_BINS / extent;
+    for(size_t i = begin; i < end; i++) {
+        size_t bin = (size_t)((obstacle_center(obstacles, obstacles->order[i], axis_y) - center_min[axis_y]) * scale);
+        bin = bin < BOIDS_BVH_BINS ? bin : BOIDS_BVH_BINS - 1;
+        bin_boxes[bin] = bin_counts[bin] ? bin_boxes[bin] : obstacles->boxes[obstacles->order[i]];
+        obstacle_box_grow(&bin_boxes[bin], &obstacles->boxes[obstacles->order[i]]);
+        bin_counts[bin]++;
+    }
+
+    //cost of splitting after each bin, the left side from a forward sweep and the right from a backward one
+    float left_costs[BOIDS_BVH_BINS];
+    obstacle_box box;
+    size_t count = 0;
+    for(size_t b = 0; b < BOIDS_BVH_BINS - 1; b++) {
+        if(bin_counts[b]) {
+            box = count ? box : bin_boxes[b];
+            obstacle_box_grow(&box, &bin_boxes[b]);
+            count += bin_counts[b];
+        }
+        left_costs[b] = count ? (float)count * obstacle_box_cost(&box) : 0.f;
+    }
+    float best_cost = (float)(end - begin) * obstacle_box_cost(&n->box);
+    size_t best_split = BOIDS_BVH_BINS;
+    count = 0;
+    for(size_t b = BOIDS_BVH_BINS - 1; b > 0; b--) {
+        if(bin_counts[b]) {
+            box = count ? box : bin_boxes[b];
+            obstacle_box_grow(&box, &bin_boxes[b]);
+            count += bin_counts[b];
+        }
+        float cost = left_costs[b - 1] + (count ? (float)count * obstacle_box_cost(&box) : 0.f) + obstacle_box_cost(&n->box);
+        if(count && count < end - begin && cost < best_cost) {
+            best_cost = cost;
+            best_split = b;
+        }
+    }
+    if(best_split == BOIDS_BVH_BINS) {
+        return;
+    }
+
+    size_t middle = begin;
+    for(size_t i = begin; i < end; i++) {
+        size_t bin = (size_t)((obstacle_center(obstacles, obstacles->order[i], axis_y) - center_min[axis_y]) * scale);
+        if((bin < BOIDS_BVH_BINS ? bin : BOIDS_BVH_BINS - 1) < best_split) {
+            uint32_t polygon = obstacles->order[i];
+            obstacles->order[i] = obstacles->order[middle];
+            obstacles->order[middle++] = polygon;
+        }
+    }
+    size_t left = obstacles->nodes_count;
+    obstacles->nodes_count += 2;
+    n->first = (uint32_t)left;
+    n->count = 0;
+    bvh_build(obstacles, left, begin, middle, depth + 1);
+    bvh_build(obstacles, left + 1, middle, end, depth + 1);
+}
+
+//reverses clockwise polygons, the hf_shape tests take their points counter-clockwise with y up
+static void obstacle_wind(hf_vec2f* points, size_t points_count) {
+    float area = 0.f;
+    for(size_t i = 0; i < points_count; i++) {
+        const float* next = points[(i + 1) % points_count];
+        area += points[i][0] * next[1] - next[0] * points[i][1];
+    }
+    if(!(area < 0.f)) {
+        return;
+    }
+    for(size_t i = 0; i < points_count / 2; i++) {
+        hf_vec2f point = { points[i][0], points[i][1] };
+        hf_vec2f_copy(points[points_count - 1 - i], points[i]);
+        hf_vec2f_copy(point, points[points_count - 1 - i]);
+    }
+}
+
+bool boids_world_set_obstacles(boids_world* world, hf_vec2f* points, const size_t* points_counts, size_t polygons_count) {
+    obstacles_free(world->obstacles);
+    world->obstacles = NULL;
+    if(!polygons_count) {
+        return true;
+    }
+    size_t points_total = 0;
+    for(size_t i = 0; i < polygons_count; i++) {
+        if(points_counts[i] < 3) {
+            return false;
+        }
+        points_total += points_counts[i];
+    }
+
+    obstacle_set* obstacles = calloc(1, sizeof(obstacle_set));
+    if(!obstacles) {
+        return false;
+    }
+    obstacles->points = malloc(points_total * sizeof(hf_vec2f));
+    obstacles->starts = malloc((polygons_count + 1) * sizeof(size_t));
+    obstacles->boxes = malloc(polygons_count * sizeof(obstacle_box));
+    obstacles->order = malloc(polygons_count * sizeof(uint32_t));
+    obstacles->nodes = malloc((2 * polygons_count - 1) * sizeof(bvh_node));
+    if(!obstacles->points || !obstacles->starts || !obstacles->boxes || !obstacles->order || !obstacles->nodes || polygons_count > UINT32_MAX) {
+        obstacles_free(obstacles);
+        return false;
+    }
+    memcpy(obstacles->points, points, points_total * sizeof(hf_vec2f));
+    obstacles->starts[0] = 0;
+    for(size_t i = 0; i < polygons_count; i++) {
+        obstacles->starts[i + 1] = obstacles->starts[i] + points_counts[i];
+        obstacle_wind(&obstacles->points[obstacles->starts[i]], points_counts[i]);
+        obstacle_box* box = &obstacles->boxes[i];
+        *box = (obstacle_box) { INFINITY, INFINITY, -INFINITY, -INFINITY };
+        for(size_t p = obstacles->starts[i]; p < obstacles->starts[i + 1]; p++) {
+            obstacle_box_grow(box, &(obstacle_box) { obstacles->points[p][0], obstacles->points[p][1], obstacles->points[p][0], obstacles->points[p][1] });
+        }
+        obstacles->order[i] = (uint32_t)i;
+    }
+    obstacles->count = polygons_count;
+    obstacles->nodes_count = 1;
+    bvh_build(obstacles, 0, 0, polygons_count, 0);
+    world->obstacles = obstacles;
+    return true;
+}
+
+static bool obstacle_box_overlaps(const obstacle_box* a, const obstacle_box* b) {
+    return a->min_x <= b->max_x && b->min_x <= a->max_x && a->min_y <= b->max_y && b->min_y <= a->max_y;
+}
+
+//calls visit with every polygon whose box overlaps box, O(log M) for a box of the size of a few polygons
+static void bvh_visit(const obstacle_set* obstacles, const obstacle_box* box, void (*visit)(uint32_t polygon, void* context), void* context) {
+    size_t stack[BOIDS_BVH_MAX_DEPTH + 2];
+    size_t stack_count = 1;
+    stack[0] = 0;
+    while(stack_count) {
+        const bvh_node* node = &obstacles->nodes[stack[--stack_count]];
+        if(!obstacle_box_overlaps(&node->box, box)) {
+            continue;
+        }
+        if(node->count) {
+            for(uint32_t i = node->first; i < node->first + node->count; i++) {
+                if(obstacle_box_overlaps(&obstacles->boxes[obstacles->order[i]], box)) {
+                    visit(obstacles->order[i], context);
+                }
+            }
+            continue;
+        }
+        stack[stack_count++] = node->first + 1;
+        stack[stack_count++] = node->first;
+    }
+}
+
+static void obstacles_cell_push(uint32_t polygon, void* context) {
+    obstacle_set* obstacles = context;
+    if(obstacles->cell_items_count >= obstacles->cell_items_capacity) {
+        size_t capacity = obstacles->cell_items_capacity ? obstacles->cell_items_capacity * 2 : 256;
+        uint32_t* new_items = realloc(obstacles->cell_items, capacity * sizeof(uint32_t));
+        if(!new_items) {
+            obstacles->cells_valid = false;
+            return;
+        }
+        obstacles->cell_items = new_items;
+        obstacles->cell_items_capacity = capacity;
+    }
+    obstacles->cell_items[obstacles->cell_items_count++] = polygon;
+}
+
+static int compare_polygon(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+//candidates of every cell: the polygons within BOIDS_OBSTACLE_RADIUS of it, looked up in the
+//copies of the cell box shifted by the bounds size, so polygons reaching across the bounds count
+static void obstacles_prepare(obstacle_set* obstacles) {
+    if(!obstacles) {
+        return;
+    }
+    if(period.x <= 0.f || period.y <= 0.f) {
+        obstacles->cells_valid = false;
+        return;
+    }
+    float width = floorf(period.x / BOIDS_MAX_RADIUS);
+    float height = floorf(period.y / BOIDS_MAX_RADIUS);
+    int columns = width >= 1.f ? (int)width : 1;
+    int rows = height >= 1.f ? (int)height : 1;
+    if(obstacles->cells_valid && obstacles->min_x == bounds.min_x && obstacles->min_y == bounds.min_y
+        && obstacles->width == columns && obstacles->height == rows && obstacles->cell_width == period.x / (float)columns && obstacles->cell_height == period.y / (float)rows) {
+        return;
+    }
+
+    obstacles->min_x = bounds.min_x;
+    obstacles->min_y = bounds.min_y;
+    obstacles->width = columns;
+    obstacles->height = rows;
+    obstacles->cell_width = period.x / (float)columns;
+    obstacles->cell_height = period.y / (float)rows;
+    size_t cells_count = (size_t)columns * (size_t)rows;
+    size_t* new_start = realloc(obstacles->cell_start, (cells_count + 1) * sizeof(size_t));
+    if(!new_start) {
+        obstacles->cells_valid = false;
+        return;
+    }
+    obstacles->cell_start = new_start;
+    obstacles->cell_items_count = 0;
+    obstacles->cells_valid = true;
+    for(int row = 0; row < rows; row++) {
+        for(int column = 0; column < columns; column++) {
+            size_t cell = (size_t)row * (size_t)columns + (size_t)column;
+            obstacles->cell_start[cell] = obstacles->cell_items_count;
+            obstacle_box box = {
+                obstacles->min_x + (float)column * obstacles->cell_width - BOIDS_OBSTACLE_RADIUS,
+                obstacles->min_y + (float)row * obstacles->cell_height - BOIDS_OBSTACLE_RADIUS,
+                obstacles->min_x + (float)(column + 1) * obstacles->cell_width + BOIDS_OBSTACLE_RADIUS,
+                obstacles->min_y + (float)(row + 1) * obstacles->cell_height + BOIDS_OBSTACLE_RADIUS,
+            };
+            for(int sy = -1; sy <= 1; sy++) {
+                for(int sx = -1; sx <= 1; sx++) {
+                    obstacle_box shifted = { box.min_x - (float)sx * period.x, box.min_y - (float)sy * period.y, box.max_x - (float)sx * period.x, box.max_y - (float)sy * period.y };
+                    bvh_visit(obstacles, &shifted, obstacles_cell_push, obstacles);
+                }
+            }
+
+            //a polygon found through two copies is only tested once
+            size_t begin = obstacles->cell_start[cell];
+            if(obstacles->cell_items_count == begin) {
+                continue;
+            }
+            qsort(&obstacles->cell_items[begin], obstacles->cell_items_count - begin, sizeof(uint32_t), compare_polygon);
+            size_t end = begin;
+            for(size_t i = begin; i < obstacles->cell_items_count; i++) {
+                if(i == begin || obstacles->cell_items[i] != obstacles->cell_items[end - 1]) {
+                    obstacles->cell_items[end++] = obstacles->cell_items[i];
+                }
+            }
+            obstacles->cell_items_count = end;
+        }
+    }
+    obstacles->cell_start[cells_count] = obstacles->cell_items_count;
+}
+
+typedef struct obstacle_query_s {
+    const obstacle_set* obstacles;
+    hf_vec2f position;
+    hf_vec2f sum;
+    size_t count;
+} obstacle_query;
+
+//adds the direction out of a polygon the boid is within BOIDS_OBSTACLE_RADIUS of, stronger the
+//closer it is. The boid is taken at its copy nearest the polygon, polygons are assumed to be
+//smaller than half the bounds.
+static void obstacle_avoid(uint32_t polygon, void* context) {
+    obstacle_query* query = context;
+    const obstacle_set* obstacles = query->obstacles;
+    const obstacle_box* box = &obstacles->boxes[polygon];
+    hf_vec2f offset;
+    wrap_offset((box->min_x + box->max_x) * .5f - query->position[0], (box->min_y + box->max_y) * .5f - query->position[1], offset);
+    hf_vec2f image = { (box->min_x + box->max_x) * .5f - offset[0], (box->min_y + box->max_y) * .5f - offset[1] };
+    float outside_x = fmaxf(fmaxf(box->min_x - image[0], image[0] - box->max_x), 0.f);
+    float outside_y = fmaxf(fmaxf(box->min_y - image[1], image[1] - box->max_y), 0.f);
+    if(outside_x * outside_x + outside_y * outside_y >= BOIDS_OBSTACLE_RADIUS * BOIDS_OBSTACLE_RADIUS) {
+        return;
+    }
+    hf_vec2f* points = &obstacles->points[obstacles->starts[polygon]];
+    size_t points_count = obstacles->starts[polygon + 1] - obstacles->starts[polygon];
+    if(!hf_shape_circle_intersects_polygon_convex(points, points_count, image, BOIDS_OBSTACLE_RADIUS)) {
+        return;
+    }
+
+    float closest_sqr = INFINITY;
+    hf_vec2f closest = { 0.f, 0.f };
+    for(size_t i = 0; i < points_count; i++) {
+        hf_vec2f point;
+        hf_segment2f_closest_point(points[i], points[(i + 1) % points_count], image, point);
+        hf_vec2f difference;
+        hf_vec2f_subtract(image, point, difference);
+        float dist_sqr = hf_vec2f_square_magnitude(difference);
+        if(dist_sqr < closest_sqr) {
+            closest_sqr = dist_sqr;
+            closest[0] = difference[0];
+            closest[1] = difference[1];
+        }
+    }
+    float distance = sqrtf(closest_sqr);
+    if(!(distance > 0.f)) {
+        return;
+    }
+    bool inside = hf_shape_point_inside_polygon_convex(points, points_count, image);
+    float strength = inside ? -1.f : 1.f - distance / BOIDS_OBSTACLE_RADIUS;
+    hf_vec2f direction;
+    hf_vec2f_multiply(closest, strength / distance, direction);
+    hf_vec2f_add(query->sum, direction, query->sum);
+    query->count++;
+}
+
+//acceleration away from the obstacles near position, false when there is none
+static bool obstacles_avoid(const obstacle_set* obstacles, hf_vec2f position, hf_vec2f out) {
+    if(!obstacles) {
+        return false;
+    }
+    obstacle_query query = {
+        .obstacles = obstacles,
+        .position = { position[0], position[1] },
+        .sum = { 0.f, 0.f },
+        .count = 0,
+    };
+    if(obstacles->cells_valid) {
+        int column = grid_coord(position[0], obstacles->min_x, obstacles->cell_width, obstacles->width);
+        int row = grid_coord(position[1], obstacles->min_y, obstacles->cell_height, obstacles->height);
+        size_t cell = (size_t)row * (size_t)obstacles->width + (size_t)column;
+        for(size_t i = obstacles->cell_start[cell]; i < obstacles->cell_start[cell + 1]; i++) {
+            obstacle_avoid(obstacles->cell_items[i], &query);
+        }
+    }
+    else {
+        obstacle_box box = { position[0] - BOIDS_OBSTACLE_RADIUS, position[1] - BOIDS_OBSTACLE_RADIUS, position[0] + BOIDS_OBSTACLE_RADIUS, position[1] + BOIDS_OBSTACLE_RADIUS };
+        bvh_visit(obstacles, &box, obstacle_avoid, &query);
+    }
+    if(!query.count) {
+        return false;
+    }
+    hf_vec2f_multiply(query.sum, BOIDS_OBSTACLE_INTENSITY / (float)query.count, out);
+    return true;
+}
+
+typedef struct update_job_s {
+    boids_world* world;
+    float delta;
+} update_job;
+
+//staggered updates, see boids_set_stagger. The first update after it is set steers every boid,
+//so each one has an acceleration to keep.
+static struct {
+    size_t period;
+    size_t step;
+    bool primed;
+} stagger;
+
+void boids_set_stagger(size_t period) {
+    stagger.period = period > 1 ? period : 0;
+    stagger.step = 0;
+    stagger.primed = false;
+}
+
+//boids steer in turns by the phase of their id, which reorders and compaction keep
+static bool stagger_due(boids_world* world, size_t i) {
+    return !stagger.period || !stagger.primed || world->ids[i] % stagger.period == stagger.step;
+}
+
+//the acceleration kept since the last turn, to measure the new one against. Zero while staggering
+//so steer starts over instead of adding to it.
+static void stagger_take(boids_world* world, size_t i, hf_vec2f out_kept) {
+    out_kept[0] = world->ax[i];
+    out_kept[1] = world->ay[i];
+    if(stagger.period) {
+        world->ax[i] = 0.f;
+        world->ay[i] = 0.f;
+    }
+}
+
+static void stagger_measure(drift_sums* drift, hf_vec2f kept, hf_vec2f acceleration) {
+    if(!stagger.period || !stagger.primed) {
+        return;
+    }
+    hf_vec2f difference;
+    hf_vec2f_subtract(acceleration, kept, difference);
+    float magnitude = hf_vec2f_magnitude(difference);
+    if(!(magnitude < INFINITY)) {//boids on top of each other steer to NaN, they would hide the others
+        return;
+    }
+    drift->count++;
+    drift->sum += (double)magnitude;
+    drift->max = magnitude > drift->max ? magnitude : drift->max;
+}
+
+static void stagger_advance(void) {
+    if(stagger.period) {
+        stagger.step = stagger.primed ? (stagger.step + 1) % stagger.period : 0;
+        stagger.primed = true;
+    }
+}
+
+//evaluates the rules in mask rules and adds their contributions to the acceleration of self, with
+//the cached ones of the others. Only rules evaluated here are stored in cache, which may be NULL
+//when every rule is.
+static void steer(boids_world* world, size_t self, boid_neighbors* neighbors, unsigned int rules, rule_cache_entry* cache) {
+    size_t species = species_index(world->species[self]);
+    rule_sums sums;
+#define RULE_INIT(name, list, interaction, kernel, intensity)\
+    sums.weights[rule_##name] = (rules & (1u << rule_##name)) && interactions.any[boids_interaction_##interaction][species] ? interactions.weights[boids_interaction_##interaction][species] : NULL;\
+    sums.sums[rule_##name][0] = 0.f;\
+    sums.sums[rule_##name][1] = 0.f;\
+    sums.counts[rule_##name] = 0;
+    BOIDS_RULES(RULE_INIT)
+#undef RULE_INIT
+
+#define RULES_SUM_CALL(list, radius, hunting_radius) rules_sum_##list(world, self, neighbors, &sums);
+    BOIDS_RADII(RULES_SUM_CALL)
+#undef RULES_SUM_CALL
+
+    hf_vec2f contributions[rules_count];
+    bool applied[rules_count];
+#define RULE_APPLY(name, list, interaction, kernel, intensity)\
+    applied[rule_##name] = (rules & (1u << rule_##name)) && rule_apply(world, self, &sums, rule_##name, rule_kernel_##kernel, intensity, contributions[rule_##name]);
+    BOIDS_RULES(RULE_APPLY)
+#undef RULE_APPLY
+
+    for(size_t r = 0; r < rules_count; r++) {
+        if(!(rules & (1u << r))) {
+            world->ax[self] += cache->contributions[r][0];
+            world->ay[self] += cache->contributions[r][1];
+            continue;
+        }
+        if(!applied[r]) {
+            contributions[r][0] = 0.f;
+            contributions[r][1] = 0.f;
+        }
+        if(cache) {
+            cache->contributions[r][0] = contributions[r][0];
+            cache->contributions[r][1] = contributions[r][1];
+        }
+        if(applied[r]) {
+            world->ax[self] += contributions[r][0];
+            world->ay[self] += contributions[r][1];
+        }
+    }
+}
+
+//reads positions and velocities of any boid but only writes the acceleration of its own range
+static void update_steer(size_t begin, size_t end, void* context) {
+    update_job* job = context;
+    boids_world* world = job->world;
+    size_t tests_count = 0;
+    drift_sums drift = { 0 };
+    for(size_t i = begin; i < end; i++) {
+        if(!stagger_due(world, i)) {
+            continue;
+        }
+        hf_vec2f kept;
+        stagger_take(world, i, kept);
+        rule_cache_entry* cache;
+        unsigned int rules = rule_cache_due(world, i, &cache);
+        boid_neighbors neighbors;
+        boid_get_neighbors(world, i, rules_radii(rules), &neighbors);
+        steer(world, i, &neighbors, rules, cache);
+        hf_vec2f avoidance;
+        if(obstacles_avoid(world->obstacles, (hf_vec2f) { world->x[i], world->y[i] }, avoidance)) {
+            world->ax[i] += avoidance[0];
+            world->ay[i] += avoidance[1];
+        }
+        tests_count += neighbors.tests;
+        stagger_measure(&drift, kept, (hf_vec2f) { world->ax[i], world->ay[i] });
+    }
+    tests_add(begin, tests_count);
+    drift_add(begin, &drift);
+}
+
+//moves boid i with acceleration, the one stored in the world is left as it is
+static void integrate(boids_world* world, size_t i, hf_vec2f acceleration, float delta) {
+    float bounds_width = bounds.max_x - bounds.min_x;
+    float bounds_height = bounds.max_y - bounds.min_y;
+    hf_vec2f velocity = { world->vx[i], world->vy[i] };
+    hf_vec2f position = { world->x[i], world->y[i] };
+
+    hf_vec2f delta_acc;
+    hf_vec2f_multiply(acceleration, delta * 2.f, delta_acc);
+    hf_vec2f_add(velocity, delta_acc, velocity);
+
+    if(hf_vec2f_square_magnitude(velocity) > (max_speed * max_speed)) {
+        hf_vec2f_normalize(velocity, velocity);
+        hf_vec2f_multiply(velocity, max_speed, velocity);
+    }
+
+    hf_vec2f movement;
+    hf_vec2f_multiply(velocity, delta, movement);
+    hf_vec2f_add(position, movement, position);
+
+    if(position[0] > bounds.max_x) {
+        position[0] -= bounds_width;
+    }
+    else if(position[0] < bounds.min_x) {
+        position[0] += bounds_width;
+    }
+    if(position[1] > bounds.max_y) {
+        position[1] -= bounds_height;
+    }
+    else if(position[1] < bounds.min_y) {
+        position[1] += bounds_height;
+    }
+
+    world->x[i] = position[0];
+    world->y[i] = position[1];
+    world->vx[i] = velocity[0];
+    world->vy[i] = velocity[1];
+}
+
+//accelerations are reset after use, unless staggering keeps them for the steps until the next turn
+static void update_integrate(size_t begin, size_t end, void* context) {
+    update_job* job = context;
+    boids_world* world = job->world;
+    for(size_t i = begin; i < end; i++) {
+        integrate(world, i, (hf_vec2f) { world->ax[i], world->ay[i] }, job->delta);
+        if(!stagger.period) {
+            world->ax[i] = 0.f;
+            world->ay[i] = 0.f;
+        }
+    }
+}
+
+//neighborhood of one boid decoded from the compact grid: self at 0 with its exact state, neighbors
+//at their offsets from it. Rules run on it unchanged, through a world made of these arrays.
+#define COMPACT_VIEW_CAPACITY (1 + boids_radius_count * BOIDS_MAX_NEIGHBORS)
+typedef struct compact_view_s {
+    boids_world world;
+    float x[COMPACT_VIEW_CAPACITY];
+    float y[COMPACT_VIEW_CAPACITY];
+    float vx[COMPACT_VIEW_CAPACITY];
+    float vy[COMPACT_VIEW_CAPACITY];
+    float ax;
+    float ay;
+    int species[COMPACT_VIEW_CAPACITY];
+} compact_view;
+
+//merges the neighbor lists into the view and renumbers them, they stay ascending
+static void compact_view_load(compact_view* view, boids_world* world, size_t self, boid_neighbors* neighbors) {
+    view->world = (boids_world) {
+        .x = view->x,
+        .y = view->y,
+        .vx = view->vx,
+        .vy = view->vy,
+        .ax = &view->ax,
+        .ay = &view->ay,
+        .species = view->species,
+    };
+    view->x[0] = 0.f;
+    view->y[0] = 0.f;
+    view->vx[0] = world->vx[self];
+    view->vy[0] = world->vy[self];
+    view->ax = world->ax[self];
+    view->ay = world->ay[self];
+    view->species[0] = world->species[self];
+
+    hf_vec2f position = { world->x[self], world->y[self] };
+    float velocity_scale = max_speed / 32767.f;
+    size_t cursors[boids_radius_count] = { 0 };
+    size_t count = 1;
+    while(true) {
+        size_t next = SIZE_MAX;
+        for(size_t r = 0; r < boids_radius_count; r++) {
+            if(cursors[r] < neighbors->counts[r] && neighbors->indices[r][cursors[r]] < next) {
+                next = neighbors->indices[r][cursors[r]];
+            }
+        }
+        if(next == SIZE_MAX) {
+            break;
+        }
+
+        const grid_compact_boid* boid = &grid.boids_compact[next];
+        hf_vec2f base;
+        hf_vec2f offset;
+        grid_compact_base(boid->column, boid->row, position, base);
+        grid_compact_offset(base, boid->x, boid->y, offset);
+        view->x[count] = offset[0];
+        view->y[count] = offset[1];
+        view->vx[count] = (float)boid->vx * velocity_scale;
+        view->vy[count] = (float)boid->vy * velocity_scale;
+        view->species[count] = boid->species;
+        for(size_t r = 0; r < boids_radius_count; r++) {
+            if(cursors[r] < neighbors->counts[r] && neighbors->indices[r][cursors[r]] == next) {
+                neighbors->indices[r][cursors[r]++] = count;
+            }
+        }
+        count++;
+    }
+    view->world.count = count;
+    view->world.capacity = count;
+}
+
+//compact mode: neighbors only come from the grid, so every boid can be moved right after steering
+static void update_compact(size_t begin, size_t end, void* context) {
+    update_job* job = context;
+    boids_world* world = job->world;
+    size_t tests_count = 0;
+    drift_sums drift = { 0 };
+    for(size_t i = begin; i < end; i++) {
+        if(!stagger_due(world, i)) {
+            integrate(world, i, (hf_vec2f) { world->ax[i], world->ay[i] }, job->delta);
+            continue;
+        }
+        hf_vec2f kept;
+        stagger_take(world, i, kept);
+        rule_cache_entry* cache;
+        unsigned int rules = rule_cache_due(world, i, &cache);
+        boid_neighbors neighbors;
+        compact_view view;
+        boid_get_neighbors(world, i, rules_radii(rules), &neighbors);
+        tests_count += neighbors.tests;
+        compact_view_load(&view, world, i, &neighbors);
+        steer(&view.world, 0, &neighbors, rules, cache);
+        hf_vec2f avoidance;
+        if(obstacles_avoid(world->obstacles, (hf_vec2f) { world->x[i], world->y[i] }, avoidance)) {
+            view.ax += avoidance[0];
+            view.ay += avoidance[1];
+        }
+        integrate(world, i, (hf_vec2f) { view.ax, view.ay }, job->delta);
+        stagger_measure(&drift, kept, (hf_vec2f) { view.ax, view.ay });
+        world->ax[i] = stagger.period ? view.ax : 0.f;
+        world->ay[i] = stagger.period ? view.ay : 0.f;
+    }
+    tests_add(begin, tests_count);
+    drift_add(begin, &drift);
+}
+
+bool boids_set_threads(size_t count) {
+    return boids_parallel_set_threads(count);
+}
+
+static void world_update(boids_world* world, float delta, float batch_skin) {
+    update_job job = {
+        .world = world,
+        .delta = delta,
+    };
+
+    if(!interactions.ready) {
+        boids_reset_interactions();
+    }
+    boids_world_drain_requests(world);
+    boids_world_compact(world);
+    update_stats_prepare(world->count);
+    neighbors_prepare(world, batch_skin);
+    aggregates_build(world);
+    rule_cache_prepare(world);
+    obstacles_prepare(world->obstacles);
+    if(grid.valid && grid.compact) {
+        boids_parallel_for(world->count, BOIDS_UPDATE_CHUNK, update_compact, &job);
+    }
+    else {
+        boids_parallel_for(world->count, BOIDS_UPDATE_CHUNK, update_steer, &job);
+        boids_parallel_for(world->count, BOIDS_UPDATE_CHUNK, update_integrate, &job);
+    }
+    update_stats_collect();
+    stagger_advance();
+    stats.steps++;
+}
+
+void boids_world_update(boids_world* world, float delta) {
+    world_update(world, delta, 0.f);
+}
+
+void boids_world_update_steps(boids_world* world, size_t steps, float delta) {
+    //no boid moves more than max_speed * delta per step, so with this skin one set of lists
+    //lasts the batch and usually the next ones, the displacement check rebuilds them when not.
+    //Modes whose neighbors differ from the plain grid's keep their own search.
+    float skin = 0.f;
+    if(steps >= 2 && !kd.enabled && !verlet.enabled && !compact_enabled && !species_partition) {
+        skin = 2.f * max_speed * fabsf(delta) * (float)steps;
+        skin = skin > BOIDS_STEPS_MIN_SKIN ? skin : BOIDS_STEPS_MIN_SKIN;
+        skin = skin < BOIDS_STEPS_MAX_SKIN ? skin : BOIDS_STEPS_MAX_SKIN;
+    }
+    for(size_t i = 0; i < steps; i++) {
+        world_update(world, delta, skin);
+    }
+}
+
+void boids_get_stats(boids_stats* out_stats) {
+    *out_stats = stats;
+}
+
+void boids_reset_stats(void) {
+    stats = (boids_stats) { 0 };
+}
+
+//the AoS api runs on a world owned by this file, copied in and out around each call
+static boids_world shim_world;
+
+static bool shim_world_load(boid* boids, size_t size) {
+    if(size > shim_world.capacity) {
+        boids_world_deinit(&shim_world);
+        if(!boids_world_init(&shim_world, size)) {
+            return false;
+        }
+    }
+    shim_world.count = size;
+    for(size_t i = 0; i < size; i++) {
+        shim_world.x[i] = boids[i].position[0];
+        shim_world.y[i] = boids[i].position[1];
+        shim_world.vx[i] = boids[i].velocity[0];
+        shim_world.vy[i] = boids[i].velocity[1];
+        shim_world.ax[i] = boids[i].acceleration[0];
+        shim_world.ay[i] = boids[i].acceleration[1];
+        shim_world.species[i] = boids[i].id;
+        shim_world.ids[i] = i;
+        shim_world.slots[i] = i;
+        shim_world.generations[i] = 0;
+    }
+    shim_world.ids_count = size;
+    shim_world.free_id = SIZE_MAX;
+    shim_world.dead_count = 0;
+    return true;
+}
+
+void boids_update(boid* boids, size_t size, float delta) {
+    if(!shim_world_load(boids, size)) {
+        return;
+    }
+    boids_world_update(&shim_world, delta);
+    for(size_t i = 0; i < size; i++) {
+        boid* b = &boids[shim_world.ids[i]];
+        b->position[0] = shim_world.x[i];
+        b->position[1] = shim_world.y[i];
+        b->velocity[0] = shim_world.vx[i];
+        b->velocity[1] = shim_world.vy[i];
+        b->acceleration[0] = shim_world.ax[i];
+        b->acceleration[1] = shim_world.ay[i];
     }
 }
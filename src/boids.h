@@ -1,10 +1,11 @@
 #ifndef BOIDS_H
 #define BOIDS_H
 
+#include <stdbool.h>
 #include <stddef.h>//size_t
+#include <stdint.h>
 
 #include "hf_lib/hf_vec.h"
-#include "hfe.h"
 
 typedef struct boid_s {
     hf_vec2f position;
@@ -13,10 +14,147 @@ typedef struct boid_s {
     int id;
 } boid;
 
+//structure of arrays storage, every array is cache line aligned and holds capacity items.
+//Despawned boids keep their slot, with id SIZE_MAX, until the next update or boids_world_compact.
+typedef struct boids_world_s {
+    size_t count;
+    size_t capacity;
+    float* x;
+    float* y;
+    float* vx;
+    float* vy;
+    float* ax;
+    float* ay;
+    int* species;
+    size_t* ids;//stable id of the boid in each slot, ids of despawned boids are given out again
+    size_t* slots;//slot of each id, slots change when the world is reordered or compacted
+    uint32_t* generations;//of each id, bumped when its boid despawns
+    size_t ids_count;//ids handed out so far, free ones are linked through slots
+    size_t free_id;//first free id, SIZE_MAX when there is none
+    size_t dead_count;
+    void* requests;//spawn and despawn requests from other threads, a lock-free stack
+    void* obstacles;//polygons its boids steer around, see boids_world_set_obstacles
+    void* memory;
+} boids_world;
+
+//refers to one boid while it lives, it never matches a boid spawned later in the same id
+typedef struct boids_handle_s {
+    size_t id;//SIZE_MAX for no boid
+    uint32_t generation;
+} boids_handle;
+
+typedef struct boids_stats_s {
+    size_t steps;
+    size_t neighbor_list_builds;//steps / neighbor_list_builds is how long lists last in neighbor list mode
+    size_t distance_tests;//boid pair distances computed by neighbor queries and neighbor list builds
+    size_t grid_builds;//full counting sorts of the grid, the other updates only migrate boids
+    size_t grid_migrations;//boids moved to another bucket by grid updates that were not full builds
+    //staggered updates: boids steered again, with the sum and largest change from the acceleration they kept
+    size_t stagger_evaluations;
+    double stagger_drift;
+    float stagger_drift_max;
+} boids_stats;
+
+#define BOIDS_MAX_SPECIES 16
+
+typedef enum boids_interaction_e {
+    boids_interaction_separation = 0,
+    boids_interaction_flock,//alignment and cohesion
+    boids_interaction_hunt,
+    boids_interaction_flee,
+    boids_interaction_count,
+} boids_interaction;
+
+typedef enum boids_rule_e {
+    boids_rule_separation = 0,
+    boids_rule_alignment,
+    boids_rule_cohesion,
+    boids_rule_hunt,
+    boids_rule_flee,
+    boids_rule_count,
+} boids_rule;
+
 void boids_set_bounds(float min_x, float min_y, float max_x, float max_y);
+//weight of boids of other in the averages the rule takes for boids of species, 0 leaves them out.
+//Species outside [0, BOIDS_MAX_SPECIES) share the last row and column. By default separation
+//weighs every pair 1, each species flocks with itself, species 4 hunts every other one and the
+//others flee from 4. Species that hunt look for targets within 11 instead of 10.
+void boids_set_interaction(boids_interaction interaction, int species, int other, float weight);
+void boids_reset_interactions(void);
+//species partitioned grid: cells keep a bucket per species and queries only walk the species a boid
+//weighs. Lists then keep the first 50 of those species, which differs in crowds. Off by default.
+void boids_set_species_partition(bool enabled);
+//the grid moves only the boids that changed cell since the last update, and falls back to a full
+//counting sort when the cells change, a cell runs out of spare room or over 1/8 of the boids move.
+//On by default; off sorts every boid every update, which gives the same grid.
+void boids_set_incremental_grid(bool enabled);
+//aggregate mode: alignment and cohesion average every boid within radius instead of the first 50
+//within 7, from per species summed-area tables of cells of about cell_size. Off by default.
+void boids_set_aggregates(bool enabled, float radius, float cell_size);
+//staggered updates: each update steers only the boids whose id modulo period is due, the others
+//move on the acceleration of their last turn. 0 or 1, the default, steers every boid every update.
+void boids_set_stagger(size_t period);
+//evaluates rule on one turn in period of each boid, spread by id, and reuses its contribution in
+//between. 0 or 1, the default, evaluates it every turn.
+void boids_set_rule_period(boids_rule rule, size_t period);
 void boids_set_max_speed(float speed);
+void boids_set_simd(bool enabled);//SIMD kernels are on by default when built in, the scalar path is the reference
+//compact mode: each update copies the grid into 16 bit cell relative positions and velocities for
+//the queries to read, the world itself stays float. There is no bandwidth gain, the copy makes it
+//slower than the default. Neighbors read are off by at most cell size / 131072 per axis plus float
+//rounding, and velocities by max speed / 65534. Only grid queries use it.
+void boids_set_compact(bool enabled);
+//caches every boid within the largest rule radius + skin and reuses the lists until some boid
+//has moved more than skin / 2 since they were built. Same neighbors as the default grid queries.
+void boids_set_neighbor_lists(bool enabled, float skin);
+//topological mode: every rule sees the k closest boids inside its radius (k at most 50) instead of
+//the first 50 in slot order. Uses a kd-tree rebuilt every update and ignores neighbor lists.
+void boids_set_nearest_neighbors(bool enabled, size_t k);
+//sorts the world along a Z-order curve every period updates so neighbors sit close in memory,
+//0 disables it. In neighbor list mode the sort waits for the next list rebuild. Lists keep the
+//first 50 boids in slot order, so in crowds a reordered world steers differently from one that is not.
+//Setting it restarts the count.
+void boids_set_reorder_period(size_t period);
+//the worker pool, like every setting and search structure here, is shared by the whole process:
+//only one thread may update worlds at a time, however many worlds there are.
+bool boids_set_threads(size_t count);//threads used by updates, including the caller. Results match a single thread.
+
+bool boids_world_init(boids_world* world, size_t capacity);
+void boids_world_deinit(boids_world* world);
+bool boids_world_copy(boids_world* dest, boids_world* src);//returns false if dest is too small
+bool boids_world_add(boids_world* world, hf_vec2f position, hf_vec2f velocity, int species);//returns false when the world is full
+bool boids_world_reserve(boids_world* world, size_t capacity);
+//O(1) pool operations. Spawn grows the world when it is full and returns a handle with id SIZE_MAX
+//when out of memory, despawn returns false for handles of boids that are already gone.
+boids_handle boids_world_spawn(boids_world* world, hf_vec2f position, hf_vec2f velocity, int species);
+bool boids_world_despawn(boids_world* world, boids_handle handle);
+bool boids_world_alive(boids_world* world, boids_handle handle);
+boids_handle boids_world_handle(boids_world* world, size_t slot);
+void boids_world_compact(boids_world* world);//drops despawned slots, the others keep their order
+//queue a spawn or despawn from any thread without locking, the world applies them in order at the
+//start of the next update or boids_world_drain_requests. Only false when out of memory.
+bool boids_world_request_spawn(boids_world* world, hf_vec2f position, hf_vec2f velocity, int species);
+bool boids_world_request_despawn(boids_world* world, boids_handle handle);
+void boids_world_drain_requests(boids_world* world);
+void boids_world_reorder(boids_world* world);//sorts the world along a Z-order curve now
+//static convex obstacles of the world, polygons_count polygons of points_counts[i] points each, one
+//after another in points. Points go counter-clockwise with y up, clockwise polygons are reversed.
+//Boids closer than 4 to one steer out of it, wrapped around the bounds like neighbors are. Polygons
+//go in a bounding volume hierarchy and each grid cell over the bounds keeps the few near it, so
+//avoidance costs about the same with thousands of obstacles as with one. Polygons are copied, 0
+//clears them, and boids_world_copy leaves those of dest. Returns false, with no obstacles set, when
+//memory runs out or a polygon has fewer than 3 points.
+bool boids_world_set_obstacles(boids_world* world, hf_vec2f* points, const size_t* points_counts, size_t polygons_count);
+
+void boids_world_update(boids_world* world, float delta);
+//same result as steps calls to boids_world_update, reorders included. In the default grid mode the
+//batch keeps neighbor lists of skin 1 to 2 between calls, about 1.7x the steps per second of single
+//updates for twice the search memory. Other modes run the single updates as they are.
+void boids_world_update_steps(boids_world* world, size_t steps, float delta);
+void boids_get_stats(boids_stats* out_stats);
+void boids_reset_stats(void);
 
+//array of structs api, kept for compatibility. Copies through an internal world on every call.
 void boids_update(boid* boids, size_t size, float delta);
-void boids_draw(boid* boids, size_t size, hfe_mesh mesh);
 
 #endif//BOIDS_H
@@ -0,0 +1,59 @@
+#include "boids_core.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "boids.h"
+
+struct boids_core_s {
+    boids_world world;
+};
+
+boids_core* boids_core_create(size_t capacity) {
+    boids_core* core = malloc(sizeof(boids_core));
+    if(!core) {
+        return NULL;
+    }
+    if(!boids_world_init(&core->world, capacity)) {
+        free(core);
+        return NULL;
+    }
+    return core;
+}
+
+void boids_core_destroy(boids_core* core) {
+    if(core) {
+        boids_world_deinit(&core->world);
+        free(core);
+    }
+}
+
+bool boids_core_add(boids_core* core, float x, float y, float vx, float vy, int species) {
+    return boids_world_add(&core->world, (hf_vec2f) { x, y }, (hf_vec2f) { vx, vy }, species);
+}
+
+bool boids_core_set_obstacles(boids_core* core, float* points, const size_t* points_counts, size_t polygons_count) {
+    return boids_world_set_obstacles(&core->world, (hf_vec2f*)(void*)points, points_counts, polygons_count);
+}
+
+size_t boids_core_count(boids_core* core) {
+    return core->world.count;
+}
+
+void boids_core_update(boids_core* core, size_t steps, float delta) {
+    boids_world_update_steps(&core->world, steps, delta);
+}
+
+bool boids_core_get(boids_core* core, size_t id, float* out_x, float* out_y, float* out_vx, float* out_vy, int* out_species) {
+    //free ids link the free list through slots, so the slot has to point back at the id
+    size_t slot = id < core->world.ids_count ? core->world.slots[id] : SIZE_MAX;
+    if(slot >= core->world.count || core->world.ids[slot] != id) {
+        return false;
+    }
+    *out_x = core->world.x[slot];
+    *out_y = core->world.y[slot];
+    *out_vx = core->world.vx[slot];
+    *out_vy = core->world.vy[slot];
+    *out_species = core->world.species[slot];
+    return true;
+}
@@ -0,0 +1,22 @@
+#ifndef BOIDS_CORE_H
+#define BOIDS_CORE_H
+
+#include <stdbool.h>
+#include <stddef.h>//size_t
+
+//world handle for programs that only simulate, the boids_core library has no window or GL
+//dependency. Settings are process wide and go through the boids_set_* functions of boids.h, so
+//programs that change them include it as well.
+typedef struct boids_core_s boids_core;
+
+boids_core* boids_core_create(size_t capacity);//returns NULL when out of memory
+void boids_core_destroy(boids_core* core);
+bool boids_core_add(boids_core* core, float x, float y, float vx, float vy, int species);//returns false when full
+//points are x, y pairs, see boids_world_set_obstacles
+bool boids_core_set_obstacles(boids_core* core, float* points, const size_t* points_counts, size_t polygons_count);
+size_t boids_core_count(boids_core* core);
+void boids_core_update(boids_core* core, size_t steps, float delta);
+//state of the boid with the given id, ids are given in add order. Returns false for unknown ids.
+bool boids_core_get(boids_core* core, size_t id, float* out_x, float* out_y, float* out_vx, float* out_vy, int* out_species);
+
+#endif//BOIDS_CORE_H
@@ -0,0 +1,44 @@
+#include "boids_draw.h"
+
+#include <math.h>
+
+#include "hf_lib/hf_transform.h"
+
+static hf_vec3f colors[] = {
+    { 0.f, 0.f, 0.f },
+    { .3f, .3f, .3f },
+    { .7f, .7f, .7f },
+    { 1.f, 1.f, 1.f },
+    { 1.f, .2f, .2f },
+};
+
+static void draw_boid(float x, float y, float vx, float vy, int species) {
+    hf_mat4f mat_rot;
+    hf_transform3f_rotation_z(atan2f(-vy, vx) + 3.1415f / 2.f, mat_rot);
+
+    hf_mat4f mat_tra;
+    hf_transform3f_translation((hf_vec3f) { x, y, 0.f }, mat_tra);
+
+    hf_mat4f mat_model;
+    hf_mat4f_multiply_mat4f(mat_tra, mat_rot, mat_model);
+
+    hfe_shader_property_set_mat4f(hfe_shader_property_get("u_Model"), mat_model[0]);
+    hf_vec3f color;
+    hf_vec3f_copy(colors[(unsigned int)species % (sizeof(colors) / sizeof(colors[0]))], color);
+    hfe_shader_property_set_3f(hfe_shader_property_get("u_Color"), color[0], color[1], color[2]);
+    hfe_mesh_draw();
+}
+
+void boids_world_draw(boids_world* world, hfe_mesh mesh) {
+    hfe_mesh_use(mesh);
+    for(size_t i = 0; i < world->count; i++) {
+        draw_boid(world->x[i], world->y[i], world->vx[i], world->vy[i], world->species[i]);
+    }
+}
+
+void boids_draw(boid* boids, size_t size, hfe_mesh mesh) {
+    hfe_mesh_use(mesh);
+    for(size_t i = 0; i < size; i++) {
+        draw_boid(boids[i].position[0], boids[i].position[1], boids[i].velocity[0], boids[i].velocity[1], boids[i].id);
+    }
+}
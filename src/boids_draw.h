@@ -0,0 +1,13 @@
+#ifndef BOIDS_DRAW_H
+#define BOIDS_DRAW_H
+
+#include <stddef.h>//size_t
+
+#include "boids.h"
+#include "hfe.h"
+
+//draws every boid with the bound shader program, which takes u_Model and u_Color
+void boids_world_draw(boids_world* world, hfe_mesh mesh);
+void boids_draw(boid* boids, size_t size, hfe_mesh mesh);
+
+#endif//BOIDS_DRAW_H
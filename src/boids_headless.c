@@ -0,0 +1,66 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sdl2/SDL_cpuinfo.h"
+#include "sdl2/SDL_timer.h"
+#include "hf_lib/hf_random.h"
+
+#include "boids.h"
+#include "boids_core.h"
+
+#define FIXED_DELTA (0.005f)
+#define AREA_PER_BOID (28.4f)//same density as the windowed build, 100 boids in a 53 x 53 world
+
+int main(int argc, char** argv) {
+    if(argc < 3) {
+        fprintf(stderr, "usage: %s <count> <steps> [seed] [threads]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    size_t count = strtoul(argv[1], NULL, 10);
+    size_t steps = strtoul(argv[2], NULL, 10);
+    uint64_t seed = argc > 3 ? strtoull(argv[3], NULL, 10) : 0;
+    size_t threads = argc > 4 ? strtoul(argv[4], NULL, 10) : (size_t)SDL_GetCPUCount();
+
+    float half_size = sqrtf((float)count * AREA_PER_BOID) / 2.f;
+    boids_set_bounds(-half_size, -half_size, half_size, half_size);
+    if(!boids_set_threads(threads)) {
+        fprintf(stderr, "could not start %zu threads\n", threads);
+        return EXIT_FAILURE;
+    }
+
+    boids_core* core = boids_core_create(count);
+    if(!core) {
+        fprintf(stderr, "out of memory for %zu boids\n", count);
+        return EXIT_FAILURE;
+    }
+    //the spawn of each boid only depends on the seed and its index, never on the order of the draws
+    for(size_t i = 0; i < count; i++) {
+        //unit velocities, a zero velocity has no direction to align with
+        float angle = hf_random_range_f(seed, i, 0, 0.f, 6.2831853f);
+        float x = hf_random_range_f(seed, i, 1, -half_size, half_size);
+        float y = hf_random_range_f(seed, i, 2, -half_size, half_size);
+        boids_core_add(core, x, y, cosf(angle), sinf(angle), i >= 3 ? hf_random_range_i(seed, i, 3, 0, 3) : 4);
+    }
+
+    Uint64 counter_start = SDL_GetPerformanceCounter();
+    boids_core_update(core, steps, FIXED_DELTA);
+    double seconds = (double)(SDL_GetPerformanceCounter() - counter_start) / (double)SDL_GetPerformanceFrequency();
+
+    //sum of the final state, runs with the same arguments print the same value
+    double checksum = 0.;
+    for(size_t i = 0; i < count; i++) {
+        float x, y, vx, vy;
+        int species;
+        boids_core_get(core, i, &x, &y, &vx, &vy, &species);
+        checksum += (double)x + (double)y + (double)vx + (double)vy;
+    }
+
+    printf("boids %zu steps %zu threads %zu seed %llu\n", count, steps, threads, (unsigned long long)seed);
+    printf("seconds %.3f steps/s %.1f boid-steps/s %.0f checksum %.6f\n",
+        seconds, seconds > 0. ? (double)steps / seconds : 0., seconds > 0. ? (double)(count * steps) / seconds : 0., checksum);
+
+    boids_core_destroy(core);
+    boids_set_threads(1);
+    return EXIT_SUCCESS;
+}
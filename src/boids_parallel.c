@@ -0,0 +1,125 @@
+#include "boids_parallel.h"
+
+#include "sdl2/SDL_atomic.h"
+#include "sdl2/SDL_mutex.h"
+#include "sdl2/SDL_thread.h"
+
+#define BOIDS_PARALLEL_MAX_THREADS 256
+
+static struct {
+    SDL_Thread* threads[BOIDS_PARALLEL_MAX_THREADS];
+    size_t threads_count;//workers besides the calling thread
+    SDL_sem* start;
+    SDL_sem* done;
+    bool quit;
+
+    //current job, written before start is posted
+    void(*func)(size_t begin, size_t end, void* context);
+    void* context;
+    size_t count;
+    size_t chunk_size;
+    SDL_atomic_t next_chunk;
+} pool;
+
+static void pool_run_chunks(void) {
+    for(;;) {
+        size_t begin = (size_t)SDL_AtomicAdd(&pool.next_chunk, 1) * pool.chunk_size;
+        if(begin >= pool.count) {
+            return;
+        }
+        size_t end = begin + pool.chunk_size < pool.count ? begin + pool.chunk_size : pool.count;
+        pool.func(begin, end, pool.context);
+    }
+}
+
+static int pool_worker(void* data) {
+    (void)data;
+    for(;;) {
+        SDL_SemWait(pool.start);
+        if(pool.quit) {
+            return 0;
+        }
+        pool_run_chunks();
+        SDL_SemPost(pool.done);
+    }
+}
+
+void boids_parallel_shutdown(void) {
+    pool.quit = true;
+    for(size_t i = 0; i < pool.threads_count; i++) {
+        SDL_SemPost(pool.start);
+    }
+    for(size_t i = 0; i < pool.threads_count; i++) {
+        SDL_WaitThread(pool.threads[i], NULL);
+    }
+    if(pool.start) {
+        SDL_DestroySemaphore(pool.start);
+    }
+    if(pool.done) {
+        SDL_DestroySemaphore(pool.done);
+    }
+    pool.start = NULL;
+    pool.done = NULL;
+    pool.threads_count = 0;
+    pool.quit = false;
+}
+
+bool boids_parallel_set_threads(size_t count) {
+    if(count > BOIDS_PARALLEL_MAX_THREADS) {
+        count = BOIDS_PARALLEL_MAX_THREADS;
+    }
+    size_t workers = count > 1 ? count - 1 : 0;
+    if(workers == pool.threads_count) {
+        return true;
+    }
+
+    boids_parallel_shutdown();
+    if(!workers) {
+        return true;
+    }
+
+    pool.start = SDL_CreateSemaphore(0);
+    pool.done = SDL_CreateSemaphore(0);
+    if(!pool.start || !pool.done) {
+        boids_parallel_shutdown();
+        return false;
+    }
+    for(size_t i = 0; i < workers; i++) {
+        pool.threads[i] = SDL_CreateThread(pool_worker, "boids_worker", NULL);
+        if(!pool.threads[i]) {
+            boids_parallel_shutdown();
+            return false;
+        }
+        pool.threads_count++;
+    }
+    return true;
+}
+
+size_t boids_parallel_get_threads(void) {
+    return pool.threads_count + 1;
+}
+
+void boids_parallel_for(size_t count, size_t chunk_size, void(*func)(size_t begin, size_t end, void* context), void* context) {
+    if(!count) {
+        return;
+    }
+    if(!pool.threads_count || count <= chunk_size) {
+        func(0, count, context);
+        return;
+    }
+
+    pool.func = func;
+    pool.context = context;
+    pool.count = count;
+    pool.chunk_size = chunk_size ? chunk_size : 1;
+    SDL_AtomicSet(&pool.next_chunk, 0);
+
+    for(size_t i = 0; i < pool.threads_count; i++) {
+        SDL_SemPost(pool.start);
+    }
+    pool_run_chunks();
+    //every worker reports once it runs out of chunks, which makes this the barrier
+    for(size_t i = 0; i < pool.threads_count; i++) {
+        SDL_SemWait(pool.done);
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef BOIDS_PARALLEL_H
+#define BOIDS_PARALLEL_H
+
+#include <stdbool.h>
+#include <stddef.h>//size_t
+
+//worker pool for the simulation, the calling thread always takes part in the work. There is one
+//pool per process and boids_parallel_for is not reentrant, so only one thread may call it at a time.
+bool boids_parallel_set_threads(size_t count);//count 1 (or 0) runs everything on the caller
+size_t boids_parallel_get_threads(void);
+void boids_parallel_shutdown(void);
+
+//runs func over [0, count) split into chunks of chunk_size items, returning once all of them are done.
+void boids_parallel_for(size_t count, size_t chunk_size, void(*func)(size_t begin, size_t end, void* context), void* context);
+
+#endif//BOIDS_PARALLEL_H
@@ -0,0 +1,152 @@
+#include "boids_sim_thread.h"
+
+#include "sdl2/SDL_atomic.h"
+#include "sdl2/SDL_thread.h"
+#include "sdl2/SDL_timer.h"
+
+#define SNAPSHOT_INDEX_MASK 3
+#define SNAPSHOT_FRESH 4//set on the shared index when the simulation published since the last read
+#define SIM_MAX_STEPS 16//cap on steps per batch, also while the cost of a step is unknown
+#define SIM_DEFAULT_BUDGET (1.f / 60.f)
+
+static struct {
+    SDL_Thread* thread;
+    SDL_atomic_t quit;
+    boids_world* world;
+    float fixed_delta;
+    SDL_atomic_t budget_us;
+    bool budget_set;//start leaves a budget set before it alone, 0 included
+
+    SDL_SpinLock stats_lock;
+    boids_sim_stats stats;
+
+    //triple buffer: back is only touched by the simulation, front only by the renderer,
+    //and the two swap their buffer with the shared one to publish or pick up a snapshot.
+    boids_world snapshots[3];
+    int back;
+    int front;
+    SDL_atomic_t shared;
+} sim;
+
+static void snapshot_publish(void) {
+    boids_world* back = &sim.snapshots[sim.back];
+    if(!boids_world_copy(back, sim.world)) {
+        //the world outgrew the snapshots, the back buffer grows with it or this publish is skipped
+        boids_world_deinit(back);
+        if(!boids_world_init(back, sim.world->capacity)) {
+            return;
+        }
+        boids_world_copy(back, sim.world);
+    }
+    SDL_MemoryBarrierRelease();//SDL_AtomicSet is only an acquire barrier, the copy has to land before the index
+    int previous = SDL_AtomicSet(&sim.shared, sim.back | SNAPSHOT_FRESH);
+    sim.back = previous & SNAPSHOT_INDEX_MASK;
+}
+
+boids_world* boids_sim_thread_snapshot(void) {
+    if(SDL_AtomicGet(&sim.shared) & SNAPSHOT_FRESH) {
+        int previous = SDL_AtomicSet(&sim.shared, sim.front);
+        SDL_MemoryBarrierAcquire();
+        sim.front = previous & SNAPSHOT_INDEX_MASK;
+    }
+    return &sim.snapshots[sim.front];
+}
+
+void boids_sim_thread_set_budget(float seconds) {
+    SDL_AtomicSet(&sim.budget_us, seconds > 0.f ? (int)(seconds * 1e6f) : 0);
+    sim.budget_set = true;
+}
+
+void boids_sim_thread_get_stats(boids_sim_stats* out_stats) {
+    SDL_AtomicLock(&sim.stats_lock);
+    *out_stats = sim.stats;
+    SDL_AtomicUnlock(&sim.stats_lock);
+}
+
+//steps that fit the budget at the last measured cost, at least one so the simulation always moves
+static size_t sim_max_steps(float step_seconds) {
+    float budget = (float)SDL_AtomicGet(&sim.budget_us) * 1e-6f;
+    if(step_seconds <= 0.f || budget / step_seconds >= (float)SIM_MAX_STEPS) {
+        return SIM_MAX_STEPS;
+    }
+    return budget > step_seconds ? (size_t)(budget / step_seconds) : 1;
+}
+
+static int sim_thread(void* data) {
+    (void)data;
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    Uint64 counter_prev = SDL_GetPerformanceCounter();
+    float fixed_time = 0.f;
+    float step_seconds = 0.f;
+    while(!SDL_AtomicGet(&sim.quit)) {
+        Uint64 counter_new = SDL_GetPerformanceCounter();
+        fixed_time += (float)(counter_new - counter_prev) / (float)frequency;
+        counter_prev = counter_new;
+
+        if(fixed_time <= sim.fixed_delta) {
+            SDL_Delay(1);
+            continue;
+        }
+        size_t steps = 0;
+        while(fixed_time > sim.fixed_delta) {
+            fixed_time -= sim.fixed_delta;
+            steps++;
+        }
+        size_t max_steps = sim_max_steps(step_seconds);
+        size_t dropped = steps > max_steps ? steps - max_steps : 0;
+        steps -= dropped;
+
+        Uint64 counter_start = SDL_GetPerformanceCounter();
+        boids_world_update_steps(sim.world, steps, sim.fixed_delta);
+        float batch_step_seconds = (float)(SDL_GetPerformanceCounter() - counter_start) / (float)frequency / (float)steps;
+        step_seconds = step_seconds > 0.f ? step_seconds * .9f + batch_step_seconds * .1f : batch_step_seconds;
+        snapshot_publish();
+
+        SDL_AtomicLock(&sim.stats_lock);
+        sim.stats.steps += steps;
+        sim.stats.step_seconds = step_seconds;
+        sim.stats.dropped_seconds += (float)dropped * sim.fixed_delta;
+        SDL_AtomicUnlock(&sim.stats_lock);
+    }
+    return 0;
+}
+
+void boids_sim_thread_stop(void) {
+    if(sim.thread) {
+        SDL_AtomicSet(&sim.quit, 1);
+        SDL_WaitThread(sim.thread, NULL);
+        sim.thread = NULL;
+    }
+    for(int i = 0; i < 3; i++) {
+        boids_world_deinit(&sim.snapshots[i]);
+    }
+}
+
+bool boids_sim_thread_start(boids_world* world, float fixed_delta) {
+    sim.world = world;
+    sim.fixed_delta = fixed_delta;
+    sim.stats = (boids_sim_stats) { 0 };
+    if(!sim.budget_set) {
+        boids_sim_thread_set_budget(SIM_DEFAULT_BUDGET);
+    }
+    for(int i = 0; i < 3; i++) {
+        if(!boids_world_init(&sim.snapshots[i], world->capacity)) {
+            boids_sim_thread_stop();
+            return false;
+        }
+    }
+
+    //the renderer starts out with the initial state in front
+    sim.front = 0;
+    sim.back = 1;
+    SDL_AtomicSet(&sim.shared, 2);
+    boids_world_copy(&sim.snapshots[sim.front], world);
+
+    SDL_AtomicSet(&sim.quit, 0);
+    sim.thread = SDL_CreateThread(sim_thread, "boids_sim", NULL);
+    if(!sim.thread) {
+        boids_sim_thread_stop();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,29 @@
+#ifndef BOIDS_SIM_THREAD_H
+#define BOIDS_SIM_THREAD_H
+
+#include <stdbool.h>
+
+#include "boids.h"
+
+//steps a world at a fixed rate on its own thread and publishes a snapshot after every batch of
+//steps through a lock-free triple buffer. The world belongs to the simulation thread until stop returns.
+bool boids_sim_thread_start(boids_world* world, float fixed_delta);
+void boids_sim_thread_stop(void);
+
+typedef struct boids_sim_stats_s {
+    size_t steps;
+    float step_seconds;//running average of the wall time of one step
+    float dropped_seconds;//simulated time skipped to stay inside the budget, the sim clock runs slow by this much
+} boids_sim_stats;
+
+//wall time a batch of steps may take, from the measured cost per step. Steps due beyond it are
+//dropped instead of piling up for the next batch. The default is 1/60 s, at most 16 steps per batch.
+//0 or less keeps one step per batch once the cost of a step is known, also when set before start.
+void boids_sim_thread_set_budget(float seconds);
+void boids_sim_thread_get_stats(boids_sim_stats* out_stats);
+
+//latest published snapshot, only for the thread that renders. It stays valid and unchanged
+//until the next call, the simulation never writes to it meanwhile.
+boids_world* boids_sim_thread_snapshot(void);
+
+#endif//BOIDS_SIM_THREAD_H
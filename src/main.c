@@ -1,12 +1,15 @@
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#include <stdio.h>
 
 #include "glad/glad.h"
 #include "sdl2/SDL.h"
 #include "stb/stb_image.h"
 #include "hf_lib/hf_mat.h"
+#include "hf_lib/hf_random.h"
 #include "hf_lib/hf_transform.h"
 #include "hf_lib/hf_shape.h"
 #include "hf_lib/hf_string.h"
@@ -14,15 +17,18 @@
 
 #include "hfe.h"
 #include "boids.h"
+#include "boids_draw.h"
+#include "boids_sim_thread.h"
 
 #define WINDOW_W 800
 #define WINDOW_H 800
 
-#define BOIDS_COUNT 100
+#define BOIDS_COUNT 100//default, the first argument after the seed overrides it
 
 int main(int argc, char** argv) {
-    (void)argc;
-    (void)argv;
+    //boids <seed> <count>, a run started with the seed shown in the title spawns the same boids again
+    uint64_t seed = argc > 1 ? strtoull(argv[1], NULL, 10) : (uint64_t)time(NULL);
+    size_t boids_count = argc > 2 ? strtoul(argv[2], NULL, 10) : BOIDS_COUNT;
 
     SDL_Init(SDL_INIT_VIDEO);
 
@@ -72,34 +78,36 @@ int main(int argc, char** argv) {
     hf_vec2f world_size = { WINDOW_W / 15, WINDOW_H / 15 };
     boids_set_bounds(-world_size[0] / 2.f, -world_size[1] / 2.f, world_size[0] / 2.f, world_size[1] / 2.f);
 
-    srand((unsigned int)time(NULL));
-    boid boids[BOIDS_COUNT] = { 0 };
-    for(size_t i = 0; i < BOIDS_COUNT; i++) {
+    boids_world world;
+    if(!boids_world_init(&world, boids_count)) {
+        return EXIT_FAILURE;
+    }
+    boids_set_threads((size_t)SDL_GetCPUCount());
+
+    //every boid draws from its own stream, so its spawn only depends on the seed and its index
+    for(size_t i = 0; i < boids_count; i++) {
         hf_vec2f vel;
-        vel[0] = (float)((rand() % 101) - 50) / 50.f;
-        vel[1] = (float)((rand() % 101) - 50) / 50.f;
-        hf_vec2f_copy(vel, boids[i].velocity);
+        vel[0] = (float)hf_random_range_i(seed, i, 0, -50, 50) / 50.f;
+        vel[1] = (float)hf_random_range_i(seed, i, 1, -50, 50) / 50.f;
 
         hf_vec2f pos;
-        pos[0] = (float)((rand() % 1001) - 500);
-        pos[1] = (float)((rand() % 1001) - 500);
-        hf_vec2f_copy(pos, boids[i].position);
+        pos[0] = (float)hf_random_range_i(seed, i, 2, -500, 500);
+        pos[1] = (float)hf_random_range_i(seed, i, 3, -500, 500);
 
-        if(i >= 3) {
-            boids[i].id = rand() % 4;
-        }
-        else {
-            boids[i].id = 4;
-        }
+        boids_world_add(&world, pos, vel, i >= 3 ? hf_random_range_i(seed, i, 4, 0, 3) : 4);
+    }
+
+    #define FIXED_DELTA (0.005f)
+    if(!boids_sim_thread_start(&world, FIXED_DELTA)) {
+        return EXIT_FAILURE;
     }
 
     SDL_GL_SetSwapInterval(1);
+    Uint64 title_ticks = SDL_GetTicks64();
     bool quit = false;
-    Uint64 ticks_zero = SDL_GetTicks64();
-    Uint64 ticks_prev = ticks_zero;
-    float fixed_time = 0.f;
-    #define FIXED_DELTA (0.005f)
     while(!quit) {
+        boids_world* snapshot = boids_sim_thread_snapshot();
+
         SDL_Event e;
         while(SDL_PollEvent(&e)) {
             if(e.type == SDL_QUIT) {
@@ -110,17 +118,32 @@ int main(int argc, char** argv) {
                     quit = true;
                 }
             }
-        }
-
-        Uint64 ticks_new = SDL_GetTicks64();
-        float delta = (float)(ticks_new - ticks_prev) / 1000.f;
-        ticks_prev = ticks_new;
-
-        fixed_time += delta;
-        while(fixed_time > FIXED_DELTA) {
-            fixed_time -= FIXED_DELTA;
-
-            boids_update(boids, BOIDS_COUNT, FIXED_DELTA);
+            //the simulation owns the world, clicks reach it through its request queue
+            if(e.type == SDL_MOUSEBUTTONDOWN) {
+                hf_vec2f cursor = {
+                    ((float)e.button.x / WINDOW_W - .5f) * world_size[0],
+                    (.5f - (float)e.button.y / WINDOW_H) * world_size[1],
+                };
+                if(e.button.button == SDL_BUTTON_LEFT) {
+                    //spawned boids keep drawing from the streams after the initial ones
+                    boids_world_request_spawn(&world, cursor, (hf_vec2f) { 0.f, 1.f }, hf_random_range_i(seed, boids_count++, 4, 0, 3));
+                }
+                else if(e.button.button == SDL_BUTTON_RIGHT) {
+                    size_t nearest = SIZE_MAX;
+                    float nearest_dist_sqr = 0.f;
+                    for(size_t i = 0; i < snapshot->count; i++) {
+                        hf_vec2f offset = { snapshot->x[i] - cursor[0], snapshot->y[i] - cursor[1] };
+                        float dist_sqr = offset[0] * offset[0] + offset[1] * offset[1];
+                        if(nearest == SIZE_MAX || dist_sqr < nearest_dist_sqr) {
+                            nearest = i;
+                            nearest_dist_sqr = dist_sqr;
+                        }
+                    }
+                    if(nearest != SIZE_MAX) {
+                        boids_world_request_despawn(&world, boids_world_handle(snapshot, nearest));
+                    }
+                }
+            }
         }
 
         //render
@@ -135,11 +158,24 @@ int main(int argc, char** argv) {
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         glDisable(GL_DEPTH_TEST);
 
-        boids_draw(boids, BOIDS_COUNT, mesh);
+        boids_world_draw(snapshot, mesh);
 
         SDL_GL_SwapWindow(window);
+
+        if(SDL_GetTicks64() - title_ticks >= 1000) {
+            title_ticks = SDL_GetTicks64();
+            boids_sim_stats stats;
+            boids_sim_thread_get_stats(&stats);
+            char title[128];
+            snprintf(title, sizeof(title), "boids - seed %llu, %.3f ms/step, %.2f s dropped", (unsigned long long)seed, stats.step_seconds * 1000.f, stats.dropped_seconds);
+            SDL_SetWindowTitle(window, title);
+        }
     }
 
+    boids_sim_thread_stop();
+    boids_set_threads(1);
+    boids_world_deinit(&world);
+
     SDL_DestroyWindow(window);
     SDL_Quit();
 
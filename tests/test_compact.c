@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <assert.h>
+#include <float.h>
+
+//white box: the neighbors compact mode decodes are held to the error budget in boids.h
+#include "../src/boids.c"
+#include "hf_lib/hf_random.h"
+
+static void fill(boids_world* world, size_t count, float size, float speed, uint64_t seed) {
+    for(size_t i = 0; i < count; i++) {
+        hf_vec2f position = { hf_random_range_f(seed, i, 0, 0.f, size), hf_random_range_f(seed, i, 1, 0.f, size) };
+        hf_vec2f velocity = { hf_random_range_f(seed, i, 2, -speed, speed), hf_random_range_f(seed, i, 3, -speed, speed) };
+        boids_world_add(world, position, velocity, i < 3 ? 4 : hf_random_range_i(seed, i, 4, 0, 3));
+    }
+}
+
+//positions off by at most cell size / 131072 per axis, plus the float rounding of coordinates as
+//large as the world's, and velocities by max speed / 65534. The boid itself is exact.
+static void assert_compact_within_budget(boids_world* world) {
+    neighbors_prepare(world, 0.f);
+    assert(grid.valid && grid.compact);
+    float extent = fmaxf(fmaxf(fabsf(bounds.min_x), fabsf(bounds.max_x)), fmaxf(fabsf(bounds.min_y), fabsf(bounds.max_y)));
+    for(size_t i = 0; i < world->count; i++) {
+        extent = fmaxf(extent, fmaxf(fabsf(world->x[i]), fabsf(world->y[i])));
+    }
+    float position_budget_x = grid.cell_width / 131072.f + 4.f * FLT_EPSILON * extent;
+    float position_budget_y = grid.cell_height / 131072.f + 4.f * FLT_EPSILON * extent;
+    float velocity_budget = max_speed / 65534.f + 1e-6f;
+    for(size_t i = 0; i < world->count; i++) {
+        boid_neighbors neighbors;
+        boid_get_neighbors(world, i, BOIDS_RADII_ALL, &neighbors);
+
+        //the view numbers neighbors in ascending order of their index, each once
+        size_t merged[COMPACT_VIEW_CAPACITY];
+        size_t merged_count = 0;
+        for(size_t r = 0; r < boids_radius_count; r++) {
+            for(size_t n = 0; n < neighbors.counts[r]; n++) {
+                merged[merged_count++] = neighbors.indices[r][n];
+            }
+        }
+        qsort(merged, merged_count, sizeof(size_t), compare_index);
+        size_t unique_count = 0;
+        for(size_t n = 0; n < merged_count; n++) {
+            if(!unique_count || merged[n] != merged[unique_count - 1]) {
+                merged[unique_count++] = merged[n];
+            }
+        }
+        merged_count = unique_count;
+
+        compact_view view;
+        compact_view_load(&view, world, i, &neighbors);
+        assert(view.world.count == merged_count + 1);
+        assert(view.x[0] == 0.f && view.y[0] == 0.f);
+        assert(view.vx[0] == world->vx[i] && view.vy[0] == world->vy[i]);
+        assert(view.species[0] == world->species[i]);
+        for(size_t n = 0; n < merged_count; n++) {
+            size_t other = merged[n];
+            hf_vec2f offset;
+            wrap_offset(world->x[other] - world->x[i], world->y[other] - world->y[i], offset);
+            assert(fabsf(view.x[n + 1] - offset[0]) <= position_budget_x);
+            assert(fabsf(view.y[n + 1] - offset[1]) <= position_budget_y);
+            assert(fabsf(view.vx[n + 1] - world->vx[other]) <= velocity_budget);
+            assert(fabsf(view.vy[n + 1] - world->vy[other]) <= velocity_budget);
+            assert(view.species[n + 1] == world->species[other]);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    boids_reset_interactions();
+    boids_set_compact(true);
+    {//speeds up to max speed
+        boids_world world;
+        assert(boids_world_init(&world, 2000));
+        fill(&world, 2000, 80.f, max_speed * .7f, 1);
+        boids_set_bounds(0.f, 0.f, 80.f, 80.f);
+        assert_compact_within_budget(&world);
+        boids_world_deinit(&world);
+    }
+    {//cells stretched to tile the bounds, boids outside them
+        boids_world world;
+        assert(boids_world_init(&world, 1000));
+        fill(&world, 1000, 70.f, 1.f, 2);
+        boids_set_bounds(-10.f, 5.f, 40.f, 42.f);
+        assert_compact_within_budget(&world);
+        boids_world_deinit(&world);
+    }
+    {//after updates
+        boids_world world;
+        assert(boids_world_init(&world, 2000));
+        fill(&world, 2000, 60.f, 1.f, 3);
+        boids_set_bounds(0.f, 0.f, 60.f, 60.f);
+        for(int step = 0; step < 20; step++) {
+            boids_world_update(&world, .005f);
+        }
+        assert_compact_within_budget(&world);
+        boids_world_deinit(&world);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,110 @@
+#include <stdlib.h>
+#include <assert.h>
+
+//white box: the grid queries are compared against the brute force scan they replace
+#include "../src/boids.c"
+#include "hf_lib/hf_random.h"
+
+static void fill(boids_world* world, size_t count, float size, uint64_t seed) {
+    for(size_t i = 0; i < count; i++) {
+        hf_vec2f position = { hf_random_range_f(seed, i, 0, 0.f, size), hf_random_range_f(seed, i, 1, 0.f, size) };
+        hf_vec2f velocity = { hf_random_range_f(seed, i, 2, -1.f, 1.f), hf_random_range_f(seed, i, 3, -1.f, 1.f) };
+        boids_world_add(world, position, velocity, i < 3 ? 4 : hf_random_range_i(seed, i, 4, 0, 3));
+    }
+}
+
+//boids that do not hunt only keep predators in their target list, the first ones in array order
+static void scan_targets(boids_world* world, size_t self, boid_neighbors* neighbors) {
+    neighbors->counts[boids_radius_target] = 0;
+    for(size_t i = 0; i < world->count && neighbors->counts[boids_radius_target] < BOIDS_MAX_NEIGHBORS; i++) {
+        hf_vec2f offset;
+        wrap_offset(world->x[self] - world->x[i], world->y[self] - world->y[i], offset);
+        float dist_sqr = offset[0] * offset[0] + offset[1] * offset[1];
+        if(i != self && interactions.predator[species_index(world->species[i])] && dist_sqr < neighbors->radius_sqr[boids_radius_target]) {
+            neighbors->indices[boids_radius_target][neighbors->counts[boids_radius_target]++] = i;
+        }
+    }
+}
+
+//every list of every boid holds the same indices whether found through the grid, or the neighbor
+//lists built from it, or by scanning all boids
+static void assert_grid_matches_scan(boids_world* world) {
+    neighbors_prepare(world, 0.f);
+    assert(grid.valid);
+    bool lists = verlet.valid;
+    for(size_t i = 0; i < world->count; i++) {
+        boid_neighbors from_grid;
+        boid_neighbors from_scan;
+        boid_get_neighbors(world, i, BOIDS_RADII_ALL, &from_grid);
+        grid.valid = false;
+        verlet.valid = false;
+        boid_get_neighbors(world, i, BOIDS_RADII_ALL, &from_scan);
+        grid.valid = true;
+        verlet.valid = lists;
+        if(!interactions.any[boids_interaction_hunt][species_index(world->species[i])]) {
+            scan_targets(world, i, &from_scan);
+        }
+        for(size_t r = 0; r < boids_radius_count; r++) {
+            assert(from_grid.counts[r] == from_scan.counts[r]);
+            for(size_t n = 0; n < from_grid.counts[r]; n++) {
+                assert(from_grid.indices[r][n] == from_scan.indices[r][n]);
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    boids_reset_interactions();
+    {//sparse world, pairs across the wrap
+        boids_world world;
+        assert(boids_world_init(&world, 2000));
+        fill(&world, 2000, 200.f, 1);
+        boids_set_bounds(0.f, 0.f, 200.f, 200.f);
+        assert_grid_matches_scan(&world);
+        boids_world_deinit(&world);
+    }
+    {//crowd, lists are cut at the first BOIDS_MAX_NEIGHBORS in array order
+        boids_world world;
+        assert(boids_world_init(&world, 3000));
+        fill(&world, 3000, 40.f, 2);
+        boids_set_bounds(0.f, 0.f, 40.f, 40.f);
+        assert_grid_matches_scan(&world);
+        boids_world_deinit(&world);
+    }
+    {//bounds narrower than 3 cells, and cells stretched to tile them
+        boids_world world;
+        assert(boids_world_init(&world, 500));
+        fill(&world, 500, 25.f, 3);
+        boids_set_bounds(0.f, 0.f, 25.f, 12.f);
+        assert_grid_matches_scan(&world);
+        boids_world_deinit(&world);
+    }
+    {//after some updates, with the boids moved and the grid migrated
+        boids_world world;
+        assert(boids_world_init(&world, 2000));
+        fill(&world, 2000, 120.f, 4);
+        boids_set_bounds(0.f, 0.f, 120.f, 120.f);
+        for(int step = 0; step < 20; step++) {
+            boids_world_update(&world, .005f);
+        }
+        assert_grid_matches_scan(&world);
+        boids_world_deinit(&world);
+    }
+    {//neighbor lists, more boids in target range than a list holds yet few enough for every boid
+        //to get one. Prey target lists only keep predators, which the sort moves off the front.
+        boids_world world;
+        assert(boids_world_init(&world, 3000));
+        fill(&world, 3000, 90.f, 5);
+        boids_set_bounds(0.f, 0.f, 90.f, 90.f);
+        boids_world_reorder(&world);
+        boids_set_neighbor_lists(true, 1.f);
+        assert_grid_matches_scan(&world);
+        assert(verlet.valid && !verlet.overflow_count);
+        boids_set_neighbor_lists(false, 0.f);
+        boids_world_deinit(&world);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <assert.h>
+
+//white box: the grid an update migrates is compared against what a full counting sort builds
+#include "../src/boids.c"
+#include "hf_lib/hf_random.h"
+
+static void fill(boids_world* world, size_t count, float size, uint64_t seed) {
+    for(size_t i = 0; i < count; i++) {
+        hf_vec2f position = { hf_random_range_f(seed, i, 0, 0.f, size), hf_random_range_f(seed, i, 1, 0.f, size) };
+        hf_vec2f velocity = { hf_random_range_f(seed, i, 2, -1.f, 1.f), hf_random_range_f(seed, i, 3, -1.f, 1.f) };
+        boids_world_add(world, position, velocity, i < 3 ? 4 : hf_random_range_i(seed, i, 4, 0, 3));
+    }
+}
+
+//every boid sits in the bucket of its position at the slot it records, and each bucket holds its
+//boids ascending, which is the grid a full sort of the world builds
+static void assert_grid_sorted(boids_world* world) {
+    assert(grid.valid && grid.boids_count == world->count);
+    for(size_t i = 0; i < world->count; i++) {
+        size_t bucket = grid.boid_cell[i];
+        assert(bucket == grid_bucket(world, i));
+        assert(grid.boid_slot[i] >= grid.cell_start[bucket] && grid.boid_slot[i] < grid.cell_end[bucket]);
+        assert(grid.items[grid.boid_slot[i]] == i);
+        assert(grid.items_x[grid.boid_slot[i]] == world->x[i] && grid.items_y[grid.boid_slot[i]] == world->y[i]);
+    }
+    size_t count = 0;
+    for(size_t b = 0; b < grid.buckets_count; b++) {
+        assert(grid.cell_start[b] <= grid.cell_end[b] && grid.cell_end[b] <= grid.cell_start[b + 1]);
+        for(size_t k = grid.cell_start[b] + 1; k < grid.cell_end[b]; k++) {
+            assert(grid.items[k - 1] < grid.items[k]);
+        }
+        count += grid.cell_end[b] - grid.cell_start[b];
+    }
+    assert(count == world->count);
+}
+
+//updates that move boids, spawn a few and despawn a few near the end, which grows the world on
+//some updates and shrinks it on others, while most grids migrate
+static void assert_updates_migrate(boids_world* world, float size, uint64_t seed) {
+    boids_stats stats_before;
+    boids_get_stats(&stats_before);
+    for(size_t step = 0; step < 40; step++) {
+        for(size_t n = 0; n < 2 + step % 2; n++) {
+            hf_vec2f position = { hf_random_range_f(seed, step, n * 2, 0.f, size), hf_random_range_f(seed, step, n * 2 + 1, 0.f, size) };
+            assert(boids_world_spawn(world, position, (hf_vec2f) { 1.f, 0.f }, (int)(n % 4)).id != SIZE_MAX);
+        }
+        for(size_t n = 0; n < 3 - step % 2; n++) {
+            assert(boids_world_despawn(world, boids_world_handle(world, world->count - 1 - n * 5)));
+        }
+        boids_world_compact(world);
+        neighbors_prepare(world, 0.f);
+        assert_grid_sorted(world);
+        boids_world_update(world, .005f);
+    }
+    boids_stats stats_after;
+    boids_get_stats(&stats_after);
+    assert(stats_after.grid_migrations > stats_before.grid_migrations);
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    boids_reset_interactions();
+    {//boids crossing cells, spawned and despawned
+        boids_world world;
+        assert(boids_world_init(&world, 3000));
+        fill(&world, 3000, 100.f, 1);
+        boids_set_bounds(0.f, 0.f, 100.f, 100.f);
+        assert_updates_migrate(&world, 100.f, 2);
+        boids_world_deinit(&world);
+    }
+    {//crowded cells running out of spare slots
+        boids_world world;
+        assert(boids_world_init(&world, 3000));
+        fill(&world, 3000, 35.f, 3);
+        boids_set_bounds(0.f, 0.f, 35.f, 35.f);
+        assert_updates_migrate(&world, 35.f, 4);
+        boids_world_deinit(&world);
+    }
+    {//species partitioned buckets
+        boids_world world;
+        assert(boids_world_init(&world, 3000));
+        fill(&world, 3000, 100.f, 5);
+        boids_set_bounds(0.f, 0.f, 100.f, 100.f);
+        boids_set_species_partition(true);
+        assert_updates_migrate(&world, 100.f, 6);
+        boids_set_species_partition(false);
+        boids_world_deinit(&world);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,104 @@
+#include <stdlib.h>
+#include <assert.h>
+
+//white box: the kd-tree queries are compared against sorting every boid by distance
+#include "../src/boids.c"
+#include "hf_lib/hf_random.h"
+
+static void fill(boids_world* world, size_t count, float size, uint64_t seed) {
+    for(size_t i = 0; i < count; i++) {
+        hf_vec2f position = { hf_random_range_f(seed, i, 0, 0.f, size), hf_random_range_f(seed, i, 1, 0.f, size) };
+        hf_vec2f velocity = { hf_random_range_f(seed, i, 2, -1.f, 1.f), hf_random_range_f(seed, i, 3, -1.f, 1.f) };
+        boids_world_add(world, position, velocity, i < 3 ? 4 : hf_random_range_i(seed, i, 4, 0, 3));
+    }
+}
+
+//the k boids closest to self inside the widest radius, ties broken by index
+static size_t brute_nearest(boids_world* world, size_t self, float radius_sqr, size_t k, float* out_dist_sqr, size_t* out_nearest) {
+    size_t count = 0;
+    for(size_t i = 0; i < world->count; i++) {
+        hf_vec2f offset;
+        wrap_offset(world->x[self] - world->x[i], world->y[self] - world->y[i], offset);
+        float dist_sqr = offset[0] * offset[0] + offset[1] * offset[1];
+        if(i == self || !(dist_sqr < radius_sqr)) {
+            continue;
+        }
+        size_t j = count;
+        while(j > 0 && out_dist_sqr[j - 1] > dist_sqr) {
+            if(j < k) {
+                out_dist_sqr[j] = out_dist_sqr[j - 1];
+                out_nearest[j] = out_nearest[j - 1];
+            }
+            j--;
+        }
+        if(j < k) {
+            out_dist_sqr[j] = dist_sqr;
+            out_nearest[j] = i;
+            count += count < k;
+        }
+    }
+    return count;
+}
+
+static void assert_kd_matches_brute(boids_world* world, size_t k) {
+    boids_set_nearest_neighbors(true, k);
+    neighbors_prepare(world, 0.f);
+    assert(kd.valid);
+    for(size_t i = 0; i < world->count; i++) {
+        boid_neighbors neighbors;
+        boid_get_neighbors(world, i, BOIDS_RADII_ALL, &neighbors);
+        float radius_sqr = 0.f;
+        for(size_t r = 0; r < boids_radius_count; r++) {
+            radius_sqr = fmaxf(radius_sqr, neighbors.radius_sqr[r]);
+        }
+        float dist_sqr[BOIDS_MAX_NEIGHBORS];
+        size_t nearest[BOIDS_MAX_NEIGHBORS];
+        size_t count = brute_nearest(world, i, radius_sqr, k, dist_sqr, nearest);
+        for(size_t r = 0; r < boids_radius_count; r++) {
+            size_t expected = 0;
+            while(expected < count && dist_sqr[expected] < neighbors.radius_sqr[r]) {
+                assert(neighbors.indices[r][expected] == nearest[expected]);
+                expected++;
+            }
+            assert(neighbors.counts[r] == expected);
+        }
+    }
+    boids_set_nearest_neighbors(false, 0);
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    boids_reset_interactions();
+    {//sparse world, neighbors across the wrap
+        boids_world world;
+        assert(boids_world_init(&world, 2000));
+        fill(&world, 2000, 150.f, 1);
+        boids_set_bounds(0.f, 0.f, 150.f, 150.f);
+        assert_kd_matches_brute(&world, 1);
+        assert_kd_matches_brute(&world, 7);
+        boids_world_deinit(&world);
+    }
+    {//crowd, where k cuts the lists
+        boids_world world;
+        assert(boids_world_init(&world, 3000));
+        fill(&world, 3000, 40.f, 2);
+        boids_set_bounds(0.f, 0.f, 40.f, 40.f);
+        assert_kd_matches_brute(&world, 7);
+        assert_kd_matches_brute(&world, BOIDS_MAX_NEIGHBORS);
+        boids_world_deinit(&world);
+    }
+    {//boids on top of each other, ties go to the lower index
+        boids_world world;
+        assert(boids_world_init(&world, 400));
+        for(size_t i = 0; i < 400; i++) {
+            hf_vec2f position = { (float)(i % 20), (float)(i % 7) };
+            boids_world_add(&world, position, (hf_vec2f) { 1.f, 0.f }, (int)(i % 4));
+        }
+        boids_set_bounds(0.f, 0.f, 20.f, 20.f);
+        assert_kd_matches_brute(&world, 7);
+        boids_world_deinit(&world);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,61 @@
+#include <stdlib.h>
+#include <assert.h>
+
+//white box: boids on either side of an obstacle edge are pushed out of it, whatever its winding,
+//and only in the world the obstacle belongs to
+#include "../src/boids.c"
+
+//a boid just inside the bottom edge, one just below it and one far away
+static void assert_pushed_out(const obstacle_set* obstacles) {
+    hf_vec2f out;
+    assert(obstacles_avoid(obstacles, (hf_vec2f) { 45.f, 41.f }, out));
+    assert(out[0] == 0.f && out[1] < 0.f);
+    assert(obstacles_avoid(obstacles, (hf_vec2f) { 45.f, 38.f }, out));
+    assert(out[0] == 0.f && out[1] < 0.f);
+    assert(!obstacles_avoid(obstacles, (hf_vec2f) { 45.f, 60.f }, out));
+}
+
+static void assert_square_avoided(hf_vec2f* square) {
+    boids_world world;
+    assert(boids_world_init(&world, 16));
+    size_t points_count = 4;
+    assert(boids_world_set_obstacles(&world, square, &points_count, 1));
+    obstacle_set* obstacles = world.obstacles;
+    assert_pushed_out(obstacles);//through the hierarchy
+    obstacles_prepare(obstacles);
+    assert(obstacles->cells_valid);
+    assert_pushed_out(obstacles);//through the cells
+    boids_world_deinit(&world);
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    boids_set_bounds(0.f, 0.f, 100.f, 100.f);
+    {//counter-clockwise
+        hf_vec2f square[] = { { 40.f, 40.f }, { 50.f, 40.f }, { 50.f, 50.f }, { 40.f, 50.f } };
+        assert_square_avoided(square);
+    }
+    {//clockwise
+        hf_vec2f square[] = { { 40.f, 40.f }, { 40.f, 50.f }, { 50.f, 50.f }, { 50.f, 40.f } };
+        assert_square_avoided(square);
+    }
+    {//each world steers around its own obstacles
+        boids_world walled;
+        boids_world open;
+        assert(boids_world_init(&walled, 16));
+        assert(boids_world_init(&open, 16));
+        hf_vec2f square[] = { { 40.f, 40.f }, { 50.f, 40.f }, { 50.f, 50.f }, { 40.f, 50.f } };
+        size_t points_count = 4;
+        assert(boids_world_set_obstacles(&walled, square, &points_count, 1));
+        boids_world_add(&walled, (hf_vec2f) { 45.f, 38.f }, (hf_vec2f) { 1.f, 0.f }, 0);
+        boids_world_add(&open, (hf_vec2f) { 45.f, 38.f }, (hf_vec2f) { 1.f, 0.f }, 0);
+        boids_world_update(&walled, .05f);
+        boids_world_update(&open, .05f);
+        assert(walled.vy[0] < 0.f && open.vy[0] == 0.f);
+        boids_world_deinit(&walled);
+        boids_world_deinit(&open);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,73 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "boids.h"
+#include "hf_lib/hf_random.h"
+
+#define TEST_COUNT 3000
+#define TEST_SIZE 90.f
+#define TEST_STEPS 12
+
+static void run(size_t threads, size_t reorder_period, boids_world* out_world) {
+    assert(boids_set_threads(threads));
+    boids_set_reorder_period(reorder_period);//restarts the count to the next reorder
+    assert(boids_world_init(out_world, TEST_COUNT));
+    for(size_t i = 0; i < TEST_COUNT; i++) {
+        hf_vec2f position = { hf_random_range_f(5, i, 0, 0.f, TEST_SIZE), hf_random_range_f(5, i, 1, 0.f, TEST_SIZE) };
+        hf_vec2f velocity = { hf_random_range_f(5, i, 2, -1.f, 1.f), hf_random_range_f(5, i, 3, -1.f, 1.f) };
+        boids_world_add(out_world, position, velocity, i < 3 ? 4 : hf_random_range_i(5, i, 4, 0, 3));
+    }
+    for(int step = 0; step < TEST_STEPS; step++) {
+        boids_world_update(out_world, .005f);
+    }
+    boids_set_threads(1);
+    boids_set_reorder_period(0);
+}
+
+//the same world stepped on 1 and 4 threads ends up bit for bit the same
+static void assert_threads_match(size_t reorder_period) {
+    boids_world single;
+    boids_world threaded;
+    run(1, reorder_period, &single);
+    run(4, reorder_period, &threaded);
+    assert(single.count == threaded.count);
+    assert(!memcmp(single.x, threaded.x, single.count * sizeof(float)));
+    assert(!memcmp(single.y, threaded.y, single.count * sizeof(float)));
+    assert(!memcmp(single.vx, threaded.vx, single.count * sizeof(float)));
+    assert(!memcmp(single.vy, threaded.vy, single.count * sizeof(float)));
+    assert(!memcmp(single.ids, threaded.ids, single.count * sizeof(size_t)));
+    boids_world_deinit(&single);
+    boids_world_deinit(&threaded);
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    boids_set_bounds(0.f, 0.f, TEST_SIZE, TEST_SIZE);
+    {//grid
+        assert_threads_match(0);
+    }
+    {//scalar kernels
+        boids_set_simd(false);
+        assert_threads_match(0);
+        boids_set_simd(true);
+    }
+    {//neighbor lists, with reordering on list rebuilds
+        boids_set_neighbor_lists(true, 1.f);
+        assert_threads_match(4);
+        boids_set_neighbor_lists(false, 0.f);
+    }
+    {//nearest mode
+        boids_set_nearest_neighbors(true, 7);
+        assert_threads_match(0);
+        boids_set_nearest_neighbors(false, 0);
+    }
+    {//compact mode
+        boids_set_compact(true);
+        assert_threads_match(0);
+        boids_set_compact(false);
+    }
+
+    return EXIT_SUCCESS;
+}